@@ -32,19 +32,37 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <netdb.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <rdma/fi_errno.h>
 
 #include <shared.h>
 #include <rdma/fi_errno.h>
 #include <rdma/fi_eq.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_endpoint.h>
 
-struct test_size_param test_size[] = {
+/*
+ * Default size sweep.  The option level selects how much of it a test
+ * runs: every test runs levels 0 and 1 (SIZE_OPT_DEFAULT) unless given
+ * '-S all', which adds the level 2 sizes in between (SIZE_OPT_ALL).
+ * set_test_sizes() replaces it with a sweep given on the command line.
+ */
+static struct test_size_param def_test_size[] = {
 	{ 1 <<  1, 1 }, { (1 <<  1) + (1 <<  0), 2},
 	{ 1 <<  2, 2 }, { (1 <<  2) + (1 <<  1), 2},
 	{ 1 <<  3, 1 }, { (1 <<  3) + (1 <<  2), 2},
@@ -70,35 +88,8 @@ struct test_size_param test_size[] = {
 	{ 1 << 23, 1 },
 };
 
-const unsigned int test_cnt = (sizeof test_size / sizeof test_size[0]);
-
-struct test_size_param test_size[] = {
-	{ 1 <<  1, 1 }, { (1 <<  1) + (1 <<  0), 2},
-	{ 1 <<  2, 1 }, { (1 <<  2) + (1 <<  1), 2},
-	{ 1 <<  3, 1 }, { (1 <<  3) + (1 <<  2), 2},
-	{ 1 <<  4, 1 }, { (1 <<  4) + (1 <<  3), 2},
-	{ 1 <<  5, 1 }, { (1 <<  5) + (1 <<  4), 2},
-	{ 1 <<  6, 1 }, { (1 <<  6) + (1 <<  5), 2},
-	{ 1 <<  7, 1 }, { (1 <<  7) + (1 <<  6), 2},
-	{ 1 <<  8, 1 }, { (1 <<  8) + (1 <<  7), 2},
-	{ 1 <<  9, 1 }, { (1 <<  9) + (1 <<  8), 2},
-	{ 1 << 10, 1 }, { (1 << 10) + (1 <<  9), 2},
-	{ 1 << 11, 1 }, { (1 << 11) + (1 << 10), 2},
-	{ 1 << 12, 1 }, { (1 << 12) + (1 << 11), 2},
-	{ 1 << 13, 1 }, { (1 << 13) + (1 << 12), 2},
-	{ 1 << 14, 1 }, { (1 << 14) + (1 << 13), 2},
-	{ 1 << 15, 1 }, { (1 << 15) + (1 << 14), 2},
-	{ 1 << 16, 1 }, { (1 << 16) + (1 << 15), 2},
-	{ 1 << 17, 1 }, { (1 << 17) + (1 << 16), 2},
-	{ 1 << 18, 1 }, { (1 << 18) + (1 << 17), 2},
-	{ 1 << 19, 1 }, { (1 << 19) + (1 << 18), 2},
-	{ 1 << 20, 1 }, { (1 << 20) + (1 << 19), 2},
-	{ 1 << 21, 1 }, { (1 << 21) + (1 << 20), 2},
-	{ 1 << 22, 1 }, { (1 << 22) + (1 << 21), 2},
-	{ 1 << 23, 1 },
-};
-
-const unsigned int test_cnt = (sizeof test_size / sizeof test_size[0]);
+struct test_size_param *test_size = def_test_size;
+unsigned int test_cnt = (sizeof def_test_size / sizeof def_test_size[0]);
 
 int getaddr(char *node, char *service, struct sockaddr **addr, socklen_t *len)
 {
@@ -162,7 +153,9 @@ void cnt_str(char *str, size_t ssize, long long cnt)
 
 int size_to_count(int size)
 {
-	if (size >= (1 << 20))
+	if (size >= (1 << 26))
+		return 10;
+	else if (size >= (1 << 20))
 		return 100;
 	else if (size >= (1 << 16))
 		return 1000;
@@ -172,6 +165,158 @@ int size_to_count(int size)
 		return 100000;
 }
 
+/* Parses a size with an optional k, m or g suffix. */
+long long parse_size(const char *str, char **end)
+{
+	long long size;
+
+	size = strtoll(str, end, 10);
+	switch (**end) {
+	case 'g': case 'G':
+		size <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		size <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		size <<= 10;
+		(*end)++;
+		break;
+	}
+	return size;
+}
+
+/* Parses a single transfer size, rejecting anything after the suffix. */
+int parse_transfer_size(const char *str, int *size)
+{
+	long long val;
+	char *end;
+
+	val = parse_size(str, &end);
+	if (end == str || *end || val < 1 || val > INT_MAX) {
+		fprintf(stderr, "invalid transfer size %s\n", str);
+		return -FI_EINVAL;
+	}
+	*size = (int) val;
+	return 0;
+}
+
+static int add_test_size(struct test_size_param **sizes, int *cnt,
+			 long long size)
+{
+	struct test_size_param *s;
+
+	if (size < 1 || size > INT_MAX) {
+		fprintf(stderr, "transfer size %lld out of range\n", size);
+		return -FI_EINVAL;
+	}
+
+	s = realloc(*sizes, (*cnt + 1) * sizeof **sizes);
+	if (!s)
+		return -FI_ENOMEM;
+	s[*cnt].size = (int) size;
+	s[*cnt].option = 0;
+	*sizes = s;
+	(*cnt)++;
+	return 0;
+}
+
+/*
+ * Parses a comma separated list of sizes and ranges into a newly
+ * allocated table.  A range is start:end:step, where the step is xN to
+ * multiply or +N to add (default x2), e.g. 64:1m:x2,1m:2m:+64k,1g.
+ */
+int parse_size_list(const char *spec, struct test_size_param **list,
+		    unsigned int *list_cnt)
+{
+	struct test_size_param *sizes = NULL;
+	long long start, end, step;
+	int cnt = 0, mult, ret = 0;
+	char *p = (char *) spec;
+
+	while (!ret && *p) {
+		start = end = parse_size(p, &p);
+		step = 0;
+		mult = 0;
+		if (*p == ':') {
+			end = parse_size(p + 1, &p);
+			mult = 1;
+			step = 2;
+			if (*p == ':' && (p[1] == 'x' || p[1] == '+')) {
+				mult = p[1] == 'x';
+				step = parse_size(p + 2, &p);
+			}
+			if ((mult && step < 2) || (!mult && step < 1) ||
+			    end < start) {
+				fprintf(stderr, "invalid size range in %s\n", spec);
+				ret = -FI_EINVAL;
+				break;
+			}
+		}
+		if (*p && *p != ',') {
+			fprintf(stderr, "invalid size list %s\n", spec);
+			ret = -FI_EINVAL;
+			break;
+		}
+		if (*p)
+			p++;
+
+		for (; !ret && start <= end; start = mult ? start * step :
+							    start + step) {
+			ret = add_test_size(&sizes, &cnt, start);
+			if (!step)
+				break;
+		}
+	}
+
+	if (!ret && !cnt) {
+		fprintf(stderr, "empty size list %s\n", spec);
+		ret = -FI_EINVAL;
+	}
+	if (ret) {
+		free(sizes);
+		return ret;
+	}
+
+	*list = sizes;
+	*list_cnt = cnt;
+	return 0;
+}
+
+/*
+ * Replaces the default size table with a size list, see
+ * parse_size_list().  Every entry runs regardless of the test's size
+ * option.
+ */
+int set_test_sizes(const char *spec)
+{
+	struct test_size_param *sizes;
+	unsigned int cnt;
+	int ret;
+
+	ret = parse_size_list(spec, &sizes, &cnt);
+	if (ret)
+		return ret;
+
+	if (test_size != def_test_size)
+		free(test_size);
+	test_size = sizes;
+	test_cnt = cnt;
+	return 0;
+}
+
+/* Largest size a sweep at the given option level will run. */
+int max_test_size(int option)
+{
+	int i, max = 0;
+
+	for (i = 0; i < TEST_CNT; i++) {
+		if (test_size[i].option <= option)
+			max = MAX(max, test_size[i].size);
+	}
+	return max;
+}
+
 int bind_fid( fid_t ep, fid_t res, uint64_t flags)
 {
 	int ret;
@@ -185,7 +330,7 @@ int bind_fid( fid_t ep, fid_t res, uint64_t flags)
 int wait_for_completion(struct fid_cq *cq, int num_completions)
 {
 	int ret;
-	struct fi_cq_entry comp;
+	struct fi_cq_tagged_entry comp;
 
 	while (num_completions > 0) {
 		ret = fi_cq_read(cq, &comp, 1);
@@ -199,3 +344,801 @@ int wait_for_completion(struct fid_cq *cq, int num_completions)
 	return 0;
 }
 
+static struct {
+	const char *name;
+	enum fi_cq_format format;
+	size_t size;
+} cq_formats[] = {
+	{ "context", FI_CQ_FORMAT_CONTEXT, sizeof(struct fi_cq_entry) },
+	{ "msg", FI_CQ_FORMAT_MSG, sizeof(struct fi_cq_msg_entry) },
+	{ "data", FI_CQ_FORMAT_DATA, sizeof(struct fi_cq_data_entry) },
+	{ "tagged", FI_CQ_FORMAT_TAGGED, sizeof(struct fi_cq_tagged_entry) },
+};
+
+#define CQ_FORMAT_CNT (sizeof cq_formats / sizeof cq_formats[0])
+
+/*
+ * Completions are always read into a struct fi_cq_tagged_entry, which is
+ * large enough to hold an entry of any of the formats above.
+ */
+int str_to_cq_format(const char *str, enum fi_cq_format *format)
+{
+	int i;
+
+	for (i = 0; i < CQ_FORMAT_CNT; i++) {
+		if (!strcasecmp(str, cq_formats[i].name)) {
+			*format = cq_formats[i].format;
+			return 0;
+		}
+	}
+	fprintf(stderr, "unknown cq format '%s', use context|msg|data|tagged\n",
+		str);
+	return -EINVAL;
+}
+
+const char *cq_format_str(enum fi_cq_format format)
+{
+	int i;
+
+	for (i = 0; i < CQ_FORMAT_CNT; i++)
+		if (cq_formats[i].format == format)
+			return cq_formats[i].name;
+	return "unspec";
+}
+
+size_t cq_entry_size(enum fi_cq_format format)
+{
+	int i;
+
+	for (i = 0; i < CQ_FORMAT_CNT; i++)
+		if (cq_formats[i].format == format)
+			return cq_formats[i].size;
+	return 0;
+}
+
+int str_to_cq_mode(const char *str)
+{
+	if (!strcasecmp(str, "split"))
+		return CQ_SPLIT;
+	if (!strcasecmp(str, "shared"))
+		return CQ_SHARED;
+	fprintf(stderr, "unknown cq mode '%s', use split|shared\n", str);
+	return -1;
+}
+
+/*
+ * With a shared CQ a read may return a completion for the other
+ * direction.  Completions are sorted by context and banked here until
+ * the side they belong to asks for them, so callers polling for sends
+ * and receives see the same behavior as with split CQs.
+ */
+static int cq_tx_done, cq_rx_done;
+static long long cq_polls, cq_empty;
+static long cq_overrun_cnt;
+
+/* Reports a failed completion and counts queue overruns */
+static int cq_readerr(struct fid_cq *cq)
+{
+	struct fi_cq_err_entry err;
+	ssize_t ret;
+
+	memset(&err, 0, sizeof err);
+	ret = fi_cq_readerr(cq, &err, sizeof err, 0);
+	if (ret < 0) {
+		printf("fi_cq_readerr %zd (%s)\n", ret, fi_strerror((int) -ret));
+		return (int) ret;
+	}
+
+	if (err.err == FI_EOVERRUN)
+		cq_overrun_cnt++;
+	printf("Completion error %d (%s)\n", err.err, fi_strerror(err.err));
+	return -err.err;
+}
+
+static int cq_reap(struct fid_cq *cq)
+{
+	struct fi_cq_tagged_entry comp;
+	int ret;
+
+	cq_polls++;
+	ret = fi_cq_read(cq, &comp, 1);
+	if (ret > 0) {
+		if (comp.op_context)
+			cq_rx_done++;
+		else
+			cq_tx_done++;
+	} else if (!ret) {
+		cq_empty++;
+	} else if (ret == -FI_EAVAIL) {
+		ret = cq_readerr(cq);
+	} else {
+		printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+	}
+	return ret;
+}
+
+/* Returns 1 if a send completion was taken, 0 if none is ready */
+int cq_read_tx(struct fid_cq *cq)
+{
+	int ret;
+
+	if (!cq_tx_done) {
+		ret = cq_reap(cq);
+		if (ret < 0)
+			return ret;
+		if (!cq_tx_done)
+			return 0;
+	}
+	cq_tx_done--;
+	return 1;
+}
+
+int cq_read_rx(struct fid_cq *cq)
+{
+	int ret;
+
+	if (!cq_rx_done) {
+		ret = cq_reap(cq);
+		if (ret < 0)
+			return ret;
+		if (!cq_rx_done)
+			return 0;
+	}
+	cq_rx_done--;
+	return 1;
+}
+
+int cq_wait_tx(struct fid_cq *cq, int num_completions)
+{
+	int ret;
+
+	while (num_completions > 0) {
+		ret = cq_read_tx(cq);
+		if (ret < 0)
+			return ret;
+		num_completions -= ret;
+	}
+	return 0;
+}
+
+int cq_wait_rx(struct fid_cq *cq, int num_completions)
+{
+	int ret;
+
+	while (num_completions > 0) {
+		ret = cq_read_rx(cq);
+		if (ret < 0)
+			return ret;
+		num_completions -= ret;
+	}
+	return 0;
+}
+
+/*
+ * -FI_EAGAIN from a post is flow control rather than an error.  Posts
+ * are wrapped as
+ *
+ *	do {
+ *		ret = fi_send(ep, buf, len, desc, NULL);
+ *	} while (post_again(&ret, scq));
+ *
+ * and each retry first reaps a completion from the CQ so the provider
+ * can make progress.  The completion is banked like any other, so
+ * tests using this must reap through cq_read_tx() and cq_read_rx().
+ */
+static long post_eagain_cnt;
+
+int post_again(int *ret, struct fid_cq *cq)
+{
+	int rc;
+
+	if (*ret != -FI_EAGAIN)
+		return 0;
+
+	post_eagain_cnt++;
+	rc = cq_reap(cq);
+	if (rc < 0) {
+		*ret = rc;
+		return 0;
+	}
+	return 1;
+}
+
+/* Number of posts retried after -FI_EAGAIN so far */
+long post_eagain(void)
+{
+	return post_eagain_cnt;
+}
+
+long cq_overruns(void)
+{
+	return cq_overrun_cnt;
+}
+
+void cq_poll_reset(void)
+{
+	cq_polls = cq_empty = 0;
+}
+
+/* Reads and clears the number of CQ reads and how many came back empty */
+void cq_poll_stats(long long *polls, long long *empty)
+{
+	*polls = cq_polls;
+	*empty = cq_empty;
+	cq_polls = cq_empty = 0;
+}
+
+
+/*
+ * Out-of-band rank rendezvous for multi-process tests.
+ *
+ * Rank 0 listens on a TCP port and hands out ranks 1..nranks-1 in the
+ * order the other processes connect.  All collective operations are
+ * routed through rank 0 (star topology), which is plenty for exchanging
+ * fabric addresses and for coarse barriers between test phases.
+ */
+static int rdv_rank, rdv_nranks;
+static int *rdv_socks;
+
+static int rdv_xfer(int sock, void *buf, size_t len, int send)
+{
+	ssize_t ret;
+	size_t done;
+
+	for (done = 0; done < len; done += ret) {
+		ret = send ? write(sock, (char *) buf + done, len - done) :
+			     read(sock, (char *) buf + done, len - done);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			perror(send ? "rdv write" : "rdv read");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int rdv_listen(char *port)
+{
+	struct addrinfo hints, *ai;
+	int sock, optval = 1, ret;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	ret = getaddrinfo(NULL, port, &hints, &ai);
+	if (ret) {
+		printf("rdv getaddrinfo %s\n", gai_strerror(ret));
+		return -1;
+	}
+
+	sock = socket(ai->ai_family, ai->ai_socktype, 0);
+	if (sock < 0) {
+		perror("rdv socket");
+		goto out;
+	}
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+	if (bind(sock, ai->ai_addr, ai->ai_addrlen) || listen(sock, 128)) {
+		perror("rdv bind/listen");
+		close(sock);
+		sock = -1;
+	}
+out:
+	freeaddrinfo(ai);
+	return sock;
+}
+
+static int rdv_connect(char *node, char *port)
+{
+	struct addrinfo hints, *ai;
+	int sock = -1, retry, ret;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(node, port, &hints, &ai);
+	if (ret) {
+		printf("rdv getaddrinfo %s\n", gai_strerror(ret));
+		return -1;
+	}
+
+	/* rank 0 may not be listening yet when all ranks start together */
+	for (retry = 0; retry < 100; retry++) {
+		sock = socket(ai->ai_family, ai->ai_socktype, 0);
+		if (sock < 0) {
+			perror("rdv socket");
+			break;
+		}
+		if (!connect(sock, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(sock);
+		sock = -1;
+		usleep(100000);
+	}
+	if (sock < 0)
+		printf("rdv unable to reach %s:%s\n", node, port);
+
+	freeaddrinfo(ai);
+	return sock;
+}
+
+int rdv_init(char *node, char *port, int *rank, int *nranks)
+{
+	int lsock, sock, i, optval = 1;
+	int hdr[2];
+
+	if (!node) {
+		if (*nranks < 1) {
+			printf("rdv invalid rank count %d\n", *nranks);
+			return -1;
+		}
+		rdv_socks = calloc(*nranks, sizeof *rdv_socks);
+		if (!rdv_socks)
+			return -1;
+
+		lsock = rdv_listen(port);
+		if (lsock < 0)
+			return -1;
+
+		for (i = 1; i < *nranks; i++) {
+			sock = accept(lsock, NULL, NULL);
+			if (sock < 0) {
+				perror("rdv accept");
+				close(lsock);
+				return -1;
+			}
+			setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof optval);
+			hdr[0] = i;
+			hdr[1] = *nranks;
+			if (rdv_xfer(sock, hdr, sizeof hdr, 1)) {
+				close(lsock);
+				return -1;
+			}
+			rdv_socks[i] = sock;
+		}
+		close(lsock);
+		rdv_rank = 0;
+	} else {
+		rdv_socks = calloc(1, sizeof *rdv_socks);
+		if (!rdv_socks)
+			return -1;
+
+		sock = rdv_connect(node, port);
+		if (sock < 0)
+			return -1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof optval);
+		if (rdv_xfer(sock, hdr, sizeof hdr, 0))
+			return -1;
+		rdv_socks[0] = sock;
+		rdv_rank = hdr[0];
+		*nranks = hdr[1];
+	}
+
+	rdv_nranks = *nranks;
+	*rank = rdv_rank;
+	return 0;
+}
+
+int rdv_allgather(void *sbuf, void *rbuf, size_t len)
+{
+	int i;
+
+	if (rdv_rank) {
+		if (rdv_xfer(rdv_socks[0], sbuf, len, 1))
+			return -1;
+		return rdv_xfer(rdv_socks[0], rbuf, len * rdv_nranks, 0);
+	}
+
+	memcpy(rbuf, sbuf, len);
+	for (i = 1; i < rdv_nranks; i++) {
+		if (rdv_xfer(rdv_socks[i], (char *) rbuf + i * len, len, 0))
+			return -1;
+	}
+	for (i = 1; i < rdv_nranks; i++) {
+		if (rdv_xfer(rdv_socks[i], rbuf, len * rdv_nranks, 1))
+			return -1;
+	}
+	return 0;
+}
+
+int rdv_barrier(void)
+{
+	char c = 0, *all;
+	int ret;
+
+	all = malloc(rdv_nranks);
+	if (!all)
+		return -1;
+	ret = rdv_allgather(&c, all, 1);
+	free(all);
+	return ret;
+}
+
+void rdv_close(void)
+{
+	int i;
+
+	if (!rdv_socks)
+		return;
+
+	if (rdv_rank) {
+		close(rdv_socks[0]);
+	} else {
+		for (i = 1; i < rdv_nranks; i++)
+			close(rdv_socks[i]);
+	}
+	free(rdv_socks);
+	rdv_socks = NULL;
+}
+
+
+/*
+ * Payload patterns for data verification.
+ *
+ * The buffer is filled with 64-bit words seed, seed + 1, seed + 2, ...
+ * so every word of every message is distinct and a misplaced, stale or
+ * truncated payload shows up as a mismatch.  Both routines go 16 bytes
+ * at a time with SSE2 where available, which keeps them well under the
+ * cost of the transfer itself; a trailing partial word is compared
+ * byte by byte.
+ */
+void fill_pattern(void *buf, size_t size, uint64_t seed)
+{
+	char *dst = buf;
+	size_t i = 0, words = size / sizeof(uint64_t);
+	uint64_t word;
+
+#ifdef __SSE2__
+	__m128i val = _mm_set_epi64x(seed + 1, seed);
+	__m128i inc = _mm_set1_epi64x(2);
+
+	for (; i + 2 <= words; i += 2) {
+		_mm_storeu_si128((__m128i *) (dst + i * sizeof word), val);
+		val = _mm_add_epi64(val, inc);
+	}
+#endif
+	for (; i < words; i++) {
+		word = seed + i;
+		memcpy(dst + i * sizeof word, &word, sizeof word);
+	}
+
+	if (size % sizeof word) {
+		word = seed + i;
+		memcpy(dst + i * sizeof word, &word, size % sizeof word);
+	}
+}
+
+/* Returns the number of 64-bit words that differ from the pattern. */
+size_t check_pattern(const void *buf, size_t size, uint64_t seed)
+{
+	const char *src = buf;
+	size_t i = 0, bad = 0, words = size / sizeof(uint64_t);
+	uint64_t word, got;
+
+#ifdef __SSE2__
+	__m128i val = _mm_set_epi64x(seed + 1, seed);
+	__m128i inc = _mm_set1_epi64x(2);
+	__m128i data;
+
+	for (; i + 2 <= words; i += 2) {
+		data = _mm_loadu_si128((const __m128i *) (src + i * sizeof word));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(data, val)) != 0xffff) {
+			bad += (memcmp(src + i * sizeof word, &val, sizeof word) != 0) +
+			       (memcmp(src + (i + 1) * sizeof word,
+				       (char *) &val + sizeof word, sizeof word) != 0);
+		}
+		val = _mm_add_epi64(val, inc);
+	}
+#endif
+	for (; i < words; i++) {
+		word = seed + i;
+		memcpy(&got, src + i * sizeof word, sizeof got);
+		if (got != word)
+			bad++;
+	}
+
+	if (size % sizeof word) {
+		word = seed + i;
+		if (memcmp(src + i * sizeof word, &word, size % sizeof word))
+			bad++;
+	}
+	return bad;
+}
+
+
+double get_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000. + ts.tv_nsec / 1000.;
+}
+
+/*
+ * Busy work that stands in for application compute.  It neither touches
+ * the clock nor calls into the library, so no progress is made while it
+ * runs unless the provider makes it on its own.
+ */
+static volatile uint64_t work_sink;
+
+void work_run(uint64_t loops)
+{
+	uint64_t i, x = work_sink;
+
+	for (i = 0; i < loops; i++)
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+	work_sink = x;
+}
+
+/* Loops of work_run() per microsecond, best of a few 10 msec runs. */
+double work_calibrate(void)
+{
+	double start, usec, rate = 0;
+	uint64_t loops = 1000;
+	int i;
+
+	do {
+		loops <<= 1;
+		start = get_usec();
+		work_run(loops);
+		usec = get_usec() - start;
+	} while (usec < 10000);
+
+	for (i = 0; i < 5; i++) {
+		start = get_usec();
+		work_run(loops);
+		rate = MAX(rate, loops / (get_usec() - start));
+	}
+	return rate;
+}
+
+/*
+ * Interval statistics for duration based (soak) runs.
+ *
+ * Each interval keeps up to max_samples per-operation times for the
+ * percentiles, replacing old ones at random once full (reservoir
+ * sampling), plus an exact min and max so a single stall is never
+ * sampled away.
+ */
+int soak_init(struct soak_stats *st, size_t max_samples)
+{
+	memset(st, 0, sizeof *st);
+	st->samples = calloc(max_samples, sizeof *st->samples);
+	if (!st->samples) {
+		perror("calloc");
+		return -FI_ENOMEM;
+	}
+	st->max_samples = max_samples;
+	st->start = get_usec();
+	return 0;
+}
+
+void soak_free(struct soak_stats *st)
+{
+	free(st->samples);
+	st->samples = NULL;
+}
+
+void soak_add(struct soak_stats *st, double usec, size_t bytes)
+{
+	size_t i;
+
+	if (!st->cnt || usec < st->min)
+		st->min = usec;
+	if (!st->cnt || usec > st->max)
+		st->max = usec;
+
+	if (st->cnt < st->max_samples) {
+		st->samples[st->cnt] = usec;
+	} else {
+		i = random() % (st->cnt + 1);
+		if (i < st->max_samples)
+			st->samples[i] = usec;
+	}
+	st->cnt++;
+	st->bytes += bytes;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+double percentile(double *sorted, size_t cnt, double p)
+{
+	return sorted[(size_t) (p * (cnt - 1))];
+}
+
+/* Sorts the samples in place. */
+double median(double *samples, size_t cnt)
+{
+	qsort(samples, cnt, sizeof *samples, cmp_double);
+	return samples[cnt / 2];
+}
+
+void soak_header(void)
+{
+	printf("%-10s%9s %8s%10s%10s%9s%9s%9s%9s%9s\n", "time", "elapsed",
+	       "xfers", "Mmsg/s", "Gb/sec", "min", "p50", "p99", "p99.9", "max");
+}
+
+/* Prints the interval ending now and starts the next one. */
+void soak_report(struct soak_stats *st, double test_start)
+{
+	char tstr[16], cstr[32];
+	struct timeval tv;
+	struct tm tm;
+	double now, usec;
+	size_t kept;
+
+	now = get_usec();
+	usec = now - st->start;
+	gettimeofday(&tv, NULL);
+	localtime_r(&tv.tv_sec, &tm);
+	strftime(tstr, sizeof tstr, "%H:%M:%S", &tm);
+	cnt_str(cstr, sizeof cstr, st->cnt);
+
+	printf("%-10s%8.1fs %8s%10.3f%10.2f", tstr, (now - test_start) / 1000000.,
+	       cstr, st->cnt / usec, (st->bytes * 8) / (1000. * usec));
+
+	kept = MIN(st->cnt, st->max_samples);
+	if (kept) {
+		qsort(st->samples, kept, sizeof *st->samples, cmp_double);
+		printf("%9.2f%9.2f%9.2f%9.2f%9.2f\n", st->min,
+		       percentile(st->samples, kept, 0.5),
+		       percentile(st->samples, kept, 0.99),
+		       percentile(st->samples, kept, 0.999), st->max);
+	} else {
+		printf("%9s%9s%9s%9s%9s\n", "-", "-", "-", "-", "-");
+	}
+	fflush(stdout);
+
+	st->cnt = 0;
+	st->bytes = 0;
+	st->start = now;
+}
+
+/* Probes run a tenth of the default count for their size unless given one. */
+int probe_count(int size, int iterations)
+{
+	if (iterations)
+		return iterations;
+	return MAX(size_to_count(size) / 10, 10);
+}
+
+int win_post_recv(struct msg_window *w)
+{
+	int ret;
+
+	ret = fi_recv(w->ep, w->buf, w->size, fi_mr_desc(w->mr), w->buf);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+int win_init(struct msg_window *w)
+{
+	int i, ret;
+
+	w->credits = w->window;
+	for (i = 0; i < w->window; i++) {
+		ret = win_post_recv(w);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int win_reap_send(struct msg_window *w)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	ret = fi_cq_read(w->scq, &comp, 1);
+	if (ret < 0) {
+		printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+	w->credits += ret;
+	return 0;
+}
+
+/* Posts a send once a credit is free; *usec is the time in fi_send. */
+int win_post_send(struct msg_window *w, size_t size, double *usec)
+{
+	double start;
+	int ret;
+
+	while (!w->credits) {
+		ret = win_reap_send(w);
+		if (ret)
+			return ret;
+	}
+
+	start = get_usec();
+	ret = fi_send(w->ep, w->buf, size, fi_mr_desc(w->mr), NULL);
+	if (usec)
+		*usec = get_usec() - start;
+	if (ret)
+		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
+	else
+		w->credits--;
+	return ret;
+}
+
+int win_wait_sends(struct msg_window *w)
+{
+	int ret;
+
+	while (w->credits < w->window) {
+		ret = win_reap_send(w);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Waits for one message and replaces the receive it consumed.  *usec is
+ * the time to reap the completion once there and repost the receive.
+ */
+int win_wait_recv(struct msg_window *w, double *usec)
+{
+	struct fi_cq_entry comp;
+	double start;
+	int ret;
+
+	do {
+		start = get_usec();
+		ret = fi_cq_read(w->rcq, &comp, 1);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+	} while (!ret);
+
+	ret = win_post_recv(w);
+	if (usec)
+		*usec = get_usec() - start;
+	return ret;
+}
+
+int win_sync(struct msg_window *w, int client)
+{
+	int ret;
+
+	ret = client ? win_post_send(w, WIN_SYNC_SIZE, NULL) : win_wait_recv(w, NULL);
+	if (ret)
+		return ret;
+	return client ? win_wait_recv(w, NULL) : win_post_send(w, WIN_SYNC_SIZE, NULL);
+}
+
+/*
+ * The client streams cnt sends of size bytes, which the server
+ * acknowledges once all have arrived.  *usec runs up to the ack.
+ */
+int win_stream(struct msg_window *w, int client, size_t size, int cnt,
+	       double *usec)
+{
+	double start;
+	int ret, i;
+
+	start = get_usec();
+	for (i = 0; i < cnt; i++) {
+		ret = client ? win_post_send(w, size, NULL) : win_wait_recv(w, NULL);
+		if (ret)
+			return ret;
+	}
+	ret = client ? win_wait_recv(w, NULL) : win_post_send(w, WIN_SYNC_SIZE, NULL);
+	if (ret)
+		return ret;
+
+	*usec = get_usec() - start;
+	return 0;
+}
@@ -38,6 +38,7 @@
 #include <sys/types.h>
 
 #include <rdma/fabric.h>
+#include <rdma/fi_eq.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,15 +49,134 @@ struct test_size_param {
 	int option;
 };
 
-extern struct test_size_param test_size[];
-const unsigned int test_cnt;
+/* Size table levels run by default and with '-S all' */
+#define SIZE_OPT_DEFAULT 1
+#define SIZE_OPT_ALL 2
+
+extern struct test_size_param *test_size;
+extern unsigned int test_cnt;
 #define TEST_CNT test_cnt
 
+long long parse_size(const char *str, char **end);
+int parse_transfer_size(const char *str, int *size);
+int parse_size_list(const char *spec, struct test_size_param **list,
+		    unsigned int *list_cnt);
+int set_test_sizes(const char *spec);
+int max_test_size(int option);
+
 int getaddr(char *node, char *service, struct sockaddr **addr, socklen_t *len);
 void size_str(char *str, size_t ssize, long long size);
 void cnt_str(char *str, size_t ssize, long long cnt);
 int size_to_count(int size);
 int wait_for_completion(struct fid_cq *cq, int num_completions);
+int bind_fid(fid_t ep, fid_t res, uint64_t flags);
+
+/* Completion queue entry formats selectable from the command line */
+int str_to_cq_format(const char *str, enum fi_cq_format *format);
+const char *cq_format_str(enum fi_cq_format format);
+size_t cq_entry_size(enum fi_cq_format format);
+
+/*
+ * Completion reaping that works with split send/receive CQs or with one
+ * CQ shared by both directions.  Transmit operations must be posted with
+ * a NULL context and receives with a non-NULL one.
+ */
+enum {
+	CQ_DEFAULT,
+	CQ_SPLIT,
+	CQ_SHARED
+};
+
+int str_to_cq_mode(const char *str);
+int cq_read_tx(struct fid_cq *cq);
+int cq_read_rx(struct fid_cq *cq);
+int cq_wait_tx(struct fid_cq *cq, int num_completions);
+int cq_wait_rx(struct fid_cq *cq, int num_completions);
+long cq_overruns(void);
+void cq_poll_reset(void);
+void cq_poll_stats(long long *polls, long long *empty);
+
+/* Posting that retries on -FI_EAGAIN while driving CQ progress */
+int post_again(int *ret, struct fid_cq *cq);
+long post_eagain(void);
+
+/* Out-of-band rendezvous between processes of a multi-rank test */
+int rdv_init(char *node, char *port, int *rank, int *nranks);
+int rdv_allgather(void *sbuf, void *rbuf, size_t len);
+int rdv_barrier(void);
+void rdv_close(void);
+
+/* Per-message payload patterns for data verification */
+void fill_pattern(void *buf, size_t size, uint64_t seed);
+size_t check_pattern(const void *buf, size_t size, uint64_t seed);
+
+/* Monotonic time in microseconds */
+double get_usec(void);
+
+/* Cycle counter for timing single calls, nanoseconds where there is none */
+static inline uint64_t get_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+#else
+	return (uint64_t) (get_usec() * 1000);
+#endif
+}
+
+/* Calibrated busy work for compute overlap measurements */
+void work_run(uint64_t loops);
+double work_calibrate(void);
+
+/* Per-interval throughput and percentile reporting for soak runs */
+struct soak_stats {
+	double *samples;
+	size_t max_samples;
+	size_t cnt;
+	double min, max;
+	long long bytes;
+	double start;
+};
+
+int soak_init(struct soak_stats *st, size_t max_samples);
+void soak_free(struct soak_stats *st);
+void soak_add(struct soak_stats *st, double usec, size_t bytes);
+void soak_header(void);
+void soak_report(struct soak_stats *st, double test_start);
+
+/* Sample statistics, percentile() takes sorted samples */
+int cmp_double(const void *a, const void *b);
+double percentile(double *sorted, size_t cnt, double p);
+double median(double *samples, size_t cnt);
+
+/*
+ * Credit based messaging for probe tests.  Both sides keep a full
+ * window of receives of the whole buffer posted at all times, and a
+ * send is only posted while one of window send credits is free.
+ */
+#define WIN_SYNC_SIZE 4
+
+struct msg_window {
+	struct fid_ep *ep;
+	struct fid_cq *scq, *rcq;
+	struct fid_mr *mr;
+	void *buf;
+	size_t size;
+	int window;
+	int credits;
+};
+
+int probe_count(int size, int iterations);
+int win_init(struct msg_window *w);
+int win_post_recv(struct msg_window *w);
+int win_post_send(struct msg_window *w, size_t size, double *usec);
+int win_wait_sends(struct msg_window *w);
+int win_wait_recv(struct msg_window *w, double *usec);
+int win_sync(struct msg_window *w, int client);
+int win_stream(struct msg_window *w, int client, size_t size, int cnt,
+	       double *usec);
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
@@ -88,6 +88,11 @@ struct pingpong_context {
 	int			 rx_depth;
 	int			 pending;
 	int			use_event;
+	enum fi_cq_format	 cq_format;
+	int			 cq_size;
+	long			 eagain;
+	int			 reaped_send;
+	int			 reaped_recv;
 };
 
 int pp_close_ctx(struct pingpong_context *ctx);
@@ -113,12 +118,12 @@ static int pp_cq_create(struct pingpong_context *ctx)
 	int rc = 0;
 
 	memset(&cq_attr, 0, sizeof cq_attr);
-	cq_attr.format 		= FI_CQ_FORMAT_CONTEXT;
+	cq_attr.format 		= ctx->cq_format;
 	if (ctx->use_event)
 		cq_attr.wait_obj = FI_WAIT_FD;				
 	else
 		cq_attr.wait_obj = FI_WAIT_NONE;
-	cq_attr.size 		= ctx->rx_depth + 1;
+	cq_attr.size 		= ctx->cq_size ? ctx->cq_size : ctx->rx_depth + 1;
 
 	rc = fi_cq_open(ctx->dom, &cq_attr, &ctx->cq, NULL);
 	if (rc) {
@@ -332,7 +337,9 @@ err:
 }
 
 static struct pingpong_context *pp_init_ctx(struct fi_info *prov, int size,
-					    int rx_depth, int use_event)
+					    int rx_depth, int use_event,
+					    enum fi_cq_format cq_format,
+					    int cq_size)
 {
 	struct pingpong_context *ctx;
 	int rc = 0;
@@ -345,6 +352,8 @@ static struct pingpong_context *pp_init_ctx(struct fi_info *prov, int size,
 	ctx->size       	= size;
 	ctx->rx_depth   	= rx_depth;
 	ctx->use_event   	= use_event;
+	ctx->cq_format   	= cq_format;
+	ctx->cq_size     	= cq_size;
 
 	ctx->buf = memalign(page_size, size);
 	if (!ctx->buf) {
@@ -408,10 +417,29 @@ static int pp_post_recv(struct pingpong_context *ctx, int n)
 
 static int pp_post_send(struct pingpong_context *ctx)
 {
-	int rc = 0;
-
-	rc = fi_send(ctx->ep, ctx->buf, ctx->size, fi_mr_desc(ctx->mr), 
-			(void *)(uintptr_t)PINGPONG_SEND_WCID);
+	struct fi_cq_tagged_entry wc;
+	int rc = 0, rd;
+
+	/*
+	 * -FI_EAGAIN is flow control, not an error.  Read the CQ before
+	 * retrying, so that a provider with manual progress can make room,
+	 * and leave whatever it returns for the main loop to account.
+	 */
+	while ((rc = fi_send(ctx->ep, ctx->buf, ctx->size, fi_mr_desc(ctx->mr),
+			     (void *)(uintptr_t)PINGPONG_SEND_WCID)) == -FI_EAGAIN) {
+		ctx->eagain++;
+		rd = fi_cq_read(ctx->cq, &wc, 1);
+		if (rd < 0) {
+			FI_ERR_LOG("fi_cq_read", rd);
+			return 1;
+		}
+		if (rd == 1) {
+			if ((int) (uintptr_t) wc.op_context == PINGPONG_SEND_WCID)
+				ctx->reaped_send++;
+			else
+				ctx->reaped_recv++;
+		}
+	}
 	if (rc) {
 		FI_ERR_LOG("fi_send", rc);
 		return 1;
@@ -420,6 +448,28 @@ static int pp_post_send(struct pingpong_context *ctx)
 	return 0;
 }
 
+static struct {
+	const char		*name;
+	enum fi_cq_format	 format;
+	size_t			 size;
+} pp_cq_formats[] = {
+	{ "context", FI_CQ_FORMAT_CONTEXT, sizeof(struct fi_cq_entry) },
+	{ "msg",     FI_CQ_FORMAT_MSG,     sizeof(struct fi_cq_msg_entry) },
+	{ "data",    FI_CQ_FORMAT_DATA,    sizeof(struct fi_cq_data_entry) },
+	{ "tagged",  FI_CQ_FORMAT_TAGGED,  sizeof(struct fi_cq_tagged_entry) },
+	{ NULL }
+};
+
+static int pp_cq_format(const char *name)
+{
+	int i;
+
+	for (i = 0; pp_cq_formats[i].name; i++)
+		if (!strcmp(name, pp_cq_formats[i].name))
+			return i;
+	return -1;
+}
+
 static void usage(const char *argv0)
 {
 	printf("Usage:\n");
@@ -436,6 +486,8 @@ static void usage(const char *argv0)
 	printf("  -r, --rx-depth=<dep>   number of receives to post at a time (default 500)\n");
 	printf("  -n, --iters=<iters>    number of exchanges (default 1000)\n");
 	printf("  -e, --events           sleep on CQ events (default poll)\n");
+	printf("  -F, --cq-format=<fmt>  CQ format context|msg|data|tagged (default context)\n");
+	printf("  -c, --cq-size=<size>   CQ entries (default rx-depth + 1)\n");
 }
 
 int main(int argc, char *argv[])
@@ -459,6 +511,8 @@ int main(int argc, char *argv[])
 	int                      rx_depth = 500;
 	int                      iters = 1000;
 	int                      use_event = 0;
+	int                      cq_fmt = 0;
+	int                      cq_size = 0;
 	int                      routs;
 	int                      rcnt, scnt;
 	int						 rc = 0;
@@ -478,10 +532,12 @@ int main(int argc, char *argv[])
 			{ .name = "rx-depth", 	.has_arg = 1, .val = 'r' },
 			{ .name = "iters",    	.has_arg = 1, .val = 'n' },
 			{ .name = "events",   	.has_arg = 0, .val = 'e' },
+			{ .name = "cq-format",	.has_arg = 1, .val = 'F' },
+			{ .name = "cq-size",  	.has_arg = 1, .val = 'c' },
 			{ 0 }
 		};
 
-		c = getopt_long(argc, argv, "p:d:i:s:m:r:n:e:",
+		c = getopt_long(argc, argv, "p:d:i:s:m:r:n:eF:c:",
 							long_options, NULL);
 		if (c == -1)
 			break;
@@ -534,6 +590,18 @@ int main(int argc, char *argv[])
 			++use_event;
 			break;
 
+		case 'c':
+			cq_size = strtol(optarg, NULL, 0);
+			break;
+
+		case 'F':
+			cq_fmt = pp_cq_format(optarg);
+			if (cq_fmt < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
 		default:
 			usage(argv[0]);
 			return 1;
@@ -592,7 +660,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	ctx = pp_init_ctx(prov, size, rx_depth, use_event);
+	ctx = pp_init_ctx(prov, size, rx_depth, use_event,
+			  pp_cq_formats[cq_fmt].format, cq_size);
 	if (!ctx)
 		return 1;
 
@@ -629,13 +698,24 @@ int main(int argc, char *argv[])
 
 	rcnt = scnt = 0;
 	while (rcnt < iters || scnt < iters) {
-		struct fi_cq_entry wc;
+		/* Large enough for an entry of any CQ format */
+		struct fi_cq_tagged_entry wc;
 		struct fi_cq_err_entry cq_err;
 		int rd;
 
-		if (use_event) {
+		if (ctx->reaped_recv || ctx->reaped_send) {
+			/* Reaped while pp_post_send() retried */
+			if (ctx->reaped_recv) {
+				ctx->reaped_recv--;
+				wc.op_context = (void *)(uintptr_t)PINGPONG_RECV_WCID;
+			} else {
+				ctx->reaped_send--;
+				wc.op_context = (void *)(uintptr_t)PINGPONG_SEND_WCID;
+			}
+			rd = 1;
+		} else if (use_event) {
 			/* Blocking read */
-			rd = fi_cq_sread(ctx->cq, &wc, sizeof wc, NULL, -1);
+			rd = fi_cq_sread(ctx->cq, &wc, 1, NULL, -1);
 		} else {
 			do {
 				rd = fi_cq_read(ctx->cq, &wc, 1);
@@ -699,6 +779,11 @@ int main(int argc, char *argv[])
 		       bytes, usec / 1000000., bytes * 8. / usec);
 		printf("%d iters in %.2f seconds = %.2f usec/iter\n",
 		       iters, usec / 1000000., usec / iters);
+		printf("cq format %s, %zu byte entries, %d entries\n",
+		       pp_cq_formats[cq_fmt].name, pp_cq_formats[cq_fmt].size,
+		       cq_size ? cq_size : rx_depth + 1);
+		if (ctx->eagain)
+			printf("%ld sends retried after -FI_EAGAIN\n", ctx->eagain);
 	}
 
 	/* Close the connection */
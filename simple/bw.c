@@ -57,14 +57,38 @@
 #include <shared.h>
 
 #define MIN_BUF_SIZE 128
+#define CTRL_SIZE 64
 #define BW_DOMAIN_NAME "FI_WRITE_BW"
+#define MAX_IOV 256
+#define VERIFY_BUF_SIZE (1 << 24)
+#define SOAK_SIZE (1 << 16)
+#define SOAK_SAMPLES (1 << 20)
+
+enum bw_op {
+	OP_WRITE,
+	OP_SEND,
+	OP_READ,
+	OP_WRITEDATA,
+	OP_SENDMSG,
+	OP_MAX
+};
+
+static const char *op_str[] = {
+	[OP_WRITE] = "write",
+	[OP_SEND] = "send",
+	[OP_READ] = "read",
+	[OP_WRITEDATA] = "writedata",
+	[OP_SENDMSG] = "sendmsg",
+};
 
 static bool custom = false;
 static bool client = false;
 static bool bidir = false;
 static bool custom_iterations = false;
+static bool verify = false;
 
-static int size_option = 1;
+static enum bw_op op = OP_WRITE;
+static int size_option = SIZE_OPT_DEFAULT;
 static int iterations;
 static int transfer_size;
 static int max_credits = 128;
@@ -75,6 +99,45 @@ static void *buf;
 static uint64_t rembuf;
 static uint64_t rkey;
 static size_t buffer_size;
+static char test_name[16];
+
+/* --iov: segments per transfer, 0 for contiguous, -1 to sweep */
+static int iov_option;
+static int iov_align = 1;
+static int iov_hdr;
+static int iov_limit = 1;
+static int iov_cnt;
+static struct iovec iov[MAX_IOV];
+static void *iov_desc[MAX_IOV];
+
+/*
+ * With --verify each data message goes through its own slot after the
+ * control area of buf, so a slot is never refilled or reposted while
+ * the transfer using it is in flight.
+ */
+static int vslots = 1;
+static uint64_t tx_seq, rx_seq, rx_post_seq, rx_data_seq;
+static long verify_errors;
+static float verify_usec;
+
+static int soak_time;
+static int soak_interval = 1;
+static struct soak_stats soak;
+static double soak_start, soak_next;
+
+static enum fi_cq_format cq_format = FI_CQ_FORMAT_CONTEXT;
+static int cq_mode;
+
+/*
+ * --window and --cq-size take a single value or a size list to sweep.
+ * New CQ sizes need new queues, so each one runs over its own
+ * connection, listening on port + index.
+ */
+static struct test_size_param *window_list, *cq_list;
+static unsigned int window_cnt = 1, cq_cnt = 1;
+static int window_max = 128;
+static int cq_index, cq_size;
+static long eagain_start;
 
 static struct fi_info hints;
 static struct fi_domain_attr domain_hints;
@@ -90,25 +153,59 @@ static struct fid_eq *cmeq;
 static struct fid_cq *rcq, *scq;
 static struct fid_mr *mr;
 
-static void show_perf(void)
+static const struct option longopts[] = {
+	{"op", required_argument, NULL, 'o'},
+	{"iov", required_argument, NULL, 'v'},
+	{"iov-align", required_argument, NULL, 'A'},
+	{"iov-hdr", required_argument, NULL, 'H'},
+	{"verify", no_argument, NULL, 'V'},
+	{"time", required_argument, NULL, 'T'},
+	{"interval", required_argument, NULL, 'i'},
+	{"cq-format", required_argument, NULL, 'F'},
+	{"cq", required_argument, NULL, 'q'},
+	{"window", required_argument, NULL, 'W'},
+	{"cq-size", required_argument, NULL, 'Q'},
+	{0, 0, 0, 0}
+};
+
+static void print_perf(const char *name, float usec, long long bytes)
 {
 	char str[32];
-	float usec;
-	long long bytes;
-
-	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
-	bytes = (long long) iterations * transfer_size;
 
 	/* name size transfers iterations bytes seconds Gb/sec usec/xfer */
+	printf("%-10s", name);
 	size_str(str, sizeof str, transfer_size);
 	printf("%-8s", str);
 	cnt_str(str, sizeof str, iterations);
 	printf("%-8s", str);
 	size_str(str, sizeof str, bytes);
 	printf("%-8s", str);
-	printf("%8.2fs%10.2f%11.2f\n",
+	printf("%8.2fs%10.2f%11.2f",
 		usec / 1000000., (bytes) / (usec),
 		(usec / iterations));
+	if (verify)
+		printf("%8ld%7.1f%%", verify_errors, 100. * verify_usec / usec);
+	if (cq_mode) {
+		long long polls, empty;
+
+		cq_poll_stats(&polls, &empty);
+		printf("%10.3f%11.2f%8.1f%%", iterations / usec,
+		       (double) polls / iterations,
+		       polls ? 100. * empty / polls : 0);
+	}
+	if (window_list || cq_list)
+		printf("%8d%8d", cq_size, max_credits);
+	printf("%8ld\n", post_eagain() - eagain_start);
+}
+
+static float elapsed(void)
+{
+	return (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+}
+
+static void show_perf(const char *name)
+{
+	print_perf(name, elapsed(), (long long) iterations * transfer_size);
 }
 
 static void init_test(int size)
@@ -119,17 +216,96 @@ static void init_test(int size)
 	}
 }
 
+/*
+ * Split the transfer into cnt segments laid out in buf, each starting
+ * on an iov_align boundary.  With --iov-hdr the first segment carries
+ * a header of that size and the payload is spread over the rest, the
+ * way a serialization layer would gather it.
+ */
+static void init_iov(int cnt)
+{
+	size_t off = 0, left = transfer_size, len;
+	int i;
+
+	if (cnt)
+		snprintf(test_name, sizeof test_name, "%s_v%d", op_str[op], cnt);
+	else
+		snprintf(test_name, sizeof test_name, "%s", op_str[op]);
+
+	if (!cnt && op == OP_SENDMSG)
+		cnt = 1;
+	iov_cnt = MIN(cnt, transfer_size);
+
+	for (i = 0; i < iov_cnt; i++) {
+		if (i == 0 && iov_hdr && iov_cnt > 1)
+			len = MIN((size_t) iov_hdr, left - (iov_cnt - 1));
+		else
+			len = left / (iov_cnt - i);
+
+		off = (off + iov_align - 1) / iov_align * iov_align;
+		iov[i].iov_base = (char *) buf + off;
+		iov[i].iov_len = len;
+		iov_desc[i] = fi_mr_desc(mr);
+		off += len;
+		left -= len;
+	}
+}
+
+static char *vslot(uint64_t seq)
+{
+	return (char *) buf + MIN_BUF_SIZE + (seq % vslots) * transfer_size;
+}
+
+/* The window is capped so that every message in flight owns a slot. */
+static void init_verify(void)
+{
+	vslots = MAX(1, MIN(128, VERIFY_BUF_SIZE / transfer_size));
+	max_credits = send_credits = recv_credits = vslots;
+	verify_errors = 0;
+	verify_usec = 0;
+}
+
+static void verify_fill(char *dst)
+{
+	struct timeval t0, t1;
+
+	gettimeofday(&t0, NULL);
+	fill_pattern(dst, transfer_size, tx_seq++);
+	gettimeofday(&t1, NULL);
+	verify_usec += (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_usec - t0.tv_usec);
+}
+
+/*
+ * Called for every receive completion.  Receives complete in the order
+ * they were posted, so while data receives are outstanding the oldest
+ * one is the slot that just completed.
+ */
+static void recv_done(void)
+{
+	struct timeval t0, t1;
+	char *src;
+
+	if (!verify || rx_seq == rx_post_seq)
+		return;
+
+	src = vslot(rx_seq++);
+
+	gettimeofday(&t0, NULL);
+	if (check_pattern(src, transfer_size, rx_data_seq++))
+		verify_errors++;
+	gettimeofday(&t1, NULL);
+	verify_usec += (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_usec - t0.tv_usec);
+}
+
 static int poll_all_sends(void)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
 	while (send_credits < max_credits) {
-		ret = fi_cq_read(scq, &comp, sizeof comp);
+		ret = cq_read_tx(scq);
 		if (ret > 0) {
 			send_credits++;
 		} else if (ret < 0) {
-			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
 			return ret;
 		}
 	}
@@ -138,15 +314,14 @@ static int poll_all_sends(void)
 
 static int poll_all_recvs(void)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
 	while (recv_credits < max_credits) {
-		ret = fi_cq_read(rcq, &comp, sizeof comp);
+		ret = cq_read_rx(rcq);
 		if (ret > 0) {
+			recv_done();
 			recv_credits++;
 		} else if (ret < 0) {
-			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
 			return ret;
 		}
 	}
@@ -155,46 +330,188 @@ static int poll_all_recvs(void)
 
 static int write_xfer(int size)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
 	while (!send_credits) {
-		ret = fi_cq_read(scq, &comp, sizeof comp);
+		ret = cq_read_tx(scq);
 		if (ret > 0) {
 			goto post;
 		} else if (ret < 0) {
-			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
 			return ret;
 		}
 	}
 
 	send_credits--;
 post:
-	ret = fi_write(ep, buf, (size_t) size, fi_mr_desc(mr), rembuf, rkey, NULL);
+	do {
+		ret = fi_write(ep, buf, (size_t) size, fi_mr_desc(mr),
+			       rembuf, rkey, NULL);
+	} while (post_again(&ret, scq));
 	if (ret)
 		printf("fi_write %d (%s)\n", ret, fi_strerror(-ret));
 
 	return ret;
 }
 
+static int read_xfer(int size)
+{
+	int ret;
+
+	while (!send_credits) {
+		ret = cq_read_tx(scq);
+		if (ret > 0) {
+			goto post;
+		} else if (ret < 0) {
+			return ret;
+		}
+	}
+
+	send_credits--;
+post:
+	do {
+		ret = fi_read(ep, buf, (size_t) size, fi_mr_desc(mr),
+			      rembuf, rkey, NULL);
+	} while (post_again(&ret, scq));
+	if (ret)
+		printf("fi_read %d (%s)\n", ret, fi_strerror(-ret));
+
+	return ret;
+}
+
+static int writedata_xfer(int size)
+{
+	int ret;
+
+	while (!send_credits) {
+		ret = cq_read_tx(scq);
+		if (ret > 0) {
+			goto post;
+		} else if (ret < 0) {
+			return ret;
+		}
+	}
+
+	send_credits--;
+post:
+	do {
+		ret = fi_writedata(ep, buf, (size_t) size, fi_mr_desc(mr), 0,
+				   rembuf, rkey, NULL);
+	} while (post_again(&ret, scq));
+	if (ret)
+		printf("fi_writedata %d (%s)\n", ret, fi_strerror(-ret));
+
+	return ret;
+}
+
 static int send_xfer(int size)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
 	while (!send_credits) {
-		ret = fi_cq_read(scq, &comp, sizeof comp);
+		ret = cq_read_tx(scq);
 		if (ret > 0) {
 			goto post;
 		} else if (ret < 0) {
-			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
 			return ret;
 		}
 	}
 
 	send_credits--;
 post:
-	ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), NULL);
+	do {
+		ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), NULL);
+	} while (post_again(&ret, scq));
+	if (ret)
+		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
+
+	return ret;
+}
+
+static int iov_xfer(void)
+{
+	struct fi_msg msg;
+	struct fi_msg_rma rma_msg;
+	struct fi_rma_iov rma_iov;
+	int ret;
+
+	while (!send_credits) {
+		ret = cq_read_tx(scq);
+		if (ret > 0) {
+			goto post;
+		} else if (ret < 0) {
+			return ret;
+		}
+	}
+
+	send_credits--;
+post:
+	switch (op) {
+	case OP_SEND:
+		ret = fi_sendv(ep, iov, iov_desc, iov_cnt, NULL);
+		if (ret && ret != -FI_EAGAIN)
+			printf("fi_sendv %d (%s)\n", ret, fi_strerror(-ret));
+		break;
+	case OP_SENDMSG:
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = iov;
+		msg.desc = iov_desc;
+		msg.iov_count = iov_cnt;
+		ret = fi_sendmsg(ep, &msg, 0);
+		if (ret && ret != -FI_EAGAIN)
+			printf("fi_sendmsg %d (%s)\n", ret, fi_strerror(-ret));
+		break;
+	case OP_READ:
+		ret = fi_readv(ep, iov, iov_desc, iov_cnt, rembuf, rkey, NULL);
+		if (ret && ret != -FI_EAGAIN)
+			printf("fi_readv %d (%s)\n", ret, fi_strerror(-ret));
+		break;
+	case OP_WRITEDATA:
+		rma_iov.addr = rembuf;
+		rma_iov.len = transfer_size;
+		rma_iov.key = rkey;
+		memset(&rma_msg, 0, sizeof rma_msg);
+		rma_msg.msg_iov = iov;
+		rma_msg.desc = iov_desc;
+		rma_msg.iov_count = iov_cnt;
+		rma_msg.rma_iov = &rma_iov;
+		rma_msg.rma_iov_count = 1;
+		ret = fi_writemsg(ep, &rma_msg, FI_REMOTE_CQ_DATA);
+		if (ret && ret != -FI_EAGAIN)
+			printf("fi_writemsg %d (%s)\n", ret, fi_strerror(-ret));
+		break;
+	default:
+		ret = fi_writev(ep, iov, iov_desc, iov_cnt, rembuf, rkey, NULL);
+		if (ret && ret != -FI_EAGAIN)
+			printf("fi_writev %d (%s)\n", ret, fi_strerror(-ret));
+		break;
+	}
+
+	if (post_again(&ret, scq))
+		goto post;
+	return ret;
+}
+
+static int send_data(void)
+{
+	char *src;
+	int ret;
+
+	while (!send_credits) {
+		ret = cq_read_tx(scq);
+		if (ret > 0) {
+			goto post;
+		} else if (ret < 0) {
+			return ret;
+		}
+	}
+
+	send_credits--;
+post:
+	src = vslot(tx_seq);
+	verify_fill(src);
+	do {
+		ret = fi_send(ep, src, (size_t) transfer_size, fi_mr_desc(mr), NULL);
+	} while (post_again(&ret, scq));
 	if (ret)
 		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
 
@@ -203,22 +520,53 @@ post:
 
 static int recv_xfer(int size)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
 	while (!recv_credits) {
-		ret = fi_cq_read(rcq, &comp, sizeof comp);
+		ret = cq_read_rx(rcq);
 		if (ret > 0) {
+			recv_done();
 			goto post;
 		} else if (ret < 0) {
-			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
 			return ret;
 		}
 	}
 
 	recv_credits--;
 post:
-	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	do {
+		ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	} while (post_again(&ret, rcq));
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+
+	return ret;
+}
+
+static int recv_data(void)
+{
+	char *dst;
+	int ret;
+
+	if (!verify)
+		return recv_xfer(transfer_size);
+
+	while (!recv_credits) {
+		ret = cq_read_rx(rcq);
+		if (ret > 0) {
+			recv_done();
+			goto post;
+		} else if (ret < 0) {
+			return ret;
+		}
+	}
+
+	recv_credits--;
+post:
+	dst = vslot(rx_post_seq++);
+	do {
+		ret = fi_recv(ep, dst, transfer_size, fi_mr_desc(mr), dst);
+	} while (post_again(&ret, rcq));
 	if (ret)
 		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
 
@@ -268,26 +616,378 @@ static int sync_test(void)
 	return ret;
 }
 
-static int run_test(void)
+/* send and writedata consume a receive at the target for every transfer */
+static int two_sided(void)
+{
+	return op == OP_SEND || op == OP_WRITEDATA || op == OP_SENDMSG;
+}
+
+static int stream_xfer(int size)
+{
+	if (iov_cnt)
+		return iov_xfer();
+
+	switch (op) {
+	case OP_SEND:
+		return verify ? send_data() : send_xfer(size);
+	case OP_READ:
+		return read_xfer(size);
+	case OP_WRITEDATA:
+		return writedata_xfer(size);
+	default:
+		return write_xfer(size);
+	}
+}
+
+/*
+ * The target posts a full window of receives before telling the
+ * initiator to start, then keeps it topped up until all transfers
+ * have arrived.
+ */
+static int recv_stream(void)
+{
+	int i, ret;
+
+	for (i = 0; i < MIN(iterations, max_credits); i++) {
+		if ((ret = recv_data())) {
+			return ret;
+		}
+	}
+
+	if ((ret = send_xfer(16))) {
+		return ret;
+	}
+	if ((ret = poll_all_sends())) {
+		return ret;
+	}
+
+	cq_poll_reset();
+	eagain_start = post_eagain();
+	gettimeofday(&start, NULL);
+	for (; i < iterations; i++) {
+		if ((ret = recv_data())) {
+			return ret;
+		}
+	}
+	if ((ret = poll_all_recvs())) {
+		return ret;
+	}
+	gettimeofday(&end, NULL);
+	return 0;
+}
+
+/* Soak runs time every post, including any wait for a send credit. */
+static void soak_sample(double usec)
+{
+	double now = get_usec();
+
+	soak_add(&soak, usec, transfer_size);
+	if (now >= soak_next) {
+		soak_report(&soak, soak_start);
+		while (soak_next <= now)
+			soak_next += soak_interval * 1000000.;
+	}
+}
+
+static int send_stream(void)
 {
-	int ret = 0, i;
+	double t0 = 0;
+	int i, ret;
 
+	if (two_sided()) {
+		if ((ret = recv_xfer(16))) {
+			return ret;
+		}
+		if ((ret = poll_all_recvs())) {
+			return ret;
+		}
+	}
+
+	cq_poll_reset();
+	eagain_start = post_eagain();
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		if (soak_time) {
+			t0 = get_usec();
+		}
+		if ((ret = stream_xfer(transfer_size))) {
+			return ret;
+		}
+		if (soak_time) {
+			soak_sample(get_usec() - t0);
+		}
+	}
+	if ((ret = poll_all_sends())) {
+		return ret;
+	}
+	gettimeofday(&end, NULL);
+	return 0;
+}
+
+/*
+ * Control messages of the bidirectional test travel through a slot at
+ * the end of buf.  One-sided transfers from the peer target the start
+ * of buf and may still be landing when this side has finished its own
+ * stream, and --verify data receives are sized for the transfer, which
+ * may be smaller than a control message.
+ */
+static char *ctrl_slot(void)
+{
+	return (char *) buf + buffer_size - CTRL_SIZE;
+}
+
+static int send_ctrl(void *val, size_t len)
+{
+	int ret;
+
+	memcpy(ctrl_slot(), val, len);
+	do {
+		ret = fi_send(ep, ctrl_slot(), len, fi_mr_desc(mr), NULL);
+	} while (post_again(&ret, scq));
+	if (ret) {
+		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+	send_credits--;
+	return poll_all_sends();
+}
+
+static int post_ctrl_recv(void)
+{
+	int ret;
+
+	do {
+		ret = fi_recv(ep, ctrl_slot(), CTRL_SIZE, fi_mr_desc(mr), ctrl_slot());
+	} while (post_again(&ret, rcq));
+	if (ret) {
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+	recv_credits--;
+	return 0;
+}
+
+static int recv_ctrl(void *val, size_t len)
+{
+	int ret;
+
+	if ((ret = post_ctrl_recv()) || (ret = poll_all_recvs())) {
+		return ret;
+	}
+	memcpy(val, ctrl_slot(), len);
+	return 0;
+}
+
+/*
+ * Both sides stream at the same time.  Completions are reaped without
+ * blocking so neither direction can stall the other.  For two-sided
+ * ops the peer's start message, received ahead of the data receives,
+ * doubles as the start barrier; one-sided ops use a handshake instead.
+ */
+static int bidir_stream(void)
+{
+	int sent = 0, rposted = 0, rcomp = 0, rx_total, ret;
+
+	rx_total = two_sided() ? iterations : 0;
+	if (rx_total) {
+		if ((ret = post_ctrl_recv())) {
+			return ret;
+		}
+		for (; rposted < MIN(rx_total, max_credits - 1); rposted++) {
+			if ((ret = recv_data())) {
+				return ret;
+			}
+		}
+		if ((ret = send_xfer(16))) {
+			return ret;
+		}
+		do {
+			ret = cq_read_rx(rcq);
+			if (ret < 0) {
+				return ret;
+			}
+		} while (!ret);
+		recv_credits++;
+	} else if (client) {
+		if ((ret = recv_xfer(16)) || (ret = send_xfer(16)) ||
+		    (ret = poll_all_sends()) || (ret = poll_all_recvs())) {
+			return ret;
+		}
+	} else {
+		if ((ret = recv_xfer(16)) || (ret = poll_all_recvs()) ||
+		    (ret = send_xfer(16)) || (ret = poll_all_sends())) {
+			return ret;
+		}
+	}
+
+	cq_poll_reset();
+	eagain_start = post_eagain();
+	gettimeofday(&start, NULL);
+	while (sent < iterations || send_credits < max_credits || rcomp < rx_total) {
+		if (sent < iterations && send_credits) {
+			if ((ret = stream_xfer(transfer_size))) {
+				return ret;
+			}
+			sent++;
+		}
+
+		ret = cq_read_tx(scq);
+		if (ret > 0) {
+			send_credits++;
+		} else if (ret < 0) {
+			return ret;
+		}
+
+		if (rcomp < rx_total) {
+			ret = cq_read_rx(rcq);
+			if (ret > 0) {
+				recv_done();
+				rcomp++;
+				recv_credits++;
+			} else if (ret < 0) {
+				return ret;
+			}
+		}
+
+		for (; rposted < rx_total && recv_credits; rposted++) {
+			if ((ret = recv_data())) {
+				return ret;
+			}
+		}
+	}
+	gettimeofday(&end, NULL);
+	return 0;
+}
+
+/*
+ * Combined bandwidth is taken over the longer of the two streaming
+ * windows, each measured from the start barrier on its own side.
+ */
+static int show_bidir_perf(void)
+{
+	float usec, peer_usec;
+	int ret;
+
+	usec = elapsed();
+	if (client) {
+		if ((ret = send_ctrl(&usec, sizeof usec)) ||
+		    (ret = recv_ctrl(&peer_usec, sizeof peer_usec))) {
+			return ret;
+		}
+	} else {
+		if ((ret = recv_ctrl(&peer_usec, sizeof peer_usec)) ||
+		    (ret = send_ctrl(&usec, sizeof usec))) {
+			return ret;
+		}
+	}
+
+	show_perf(test_name);
+	print_perf("bidir", MAX(usec, peer_usec),
+		   (long long) iterations * transfer_size * 2);
+	return 0;
+}
+
+/*
+ * Rounds of streaming repeat until the client's deadline passes; after
+ * each one the client tells the server whether another follows.
+ */
+static int soak_continue(int *more)
+{
+	int ret;
+
+	if (client) {
+		*(int *) buf = *more;
+		if ((ret = send_xfer(sizeof *more)) || (ret = poll_all_sends())) {
+			return ret;
+		}
+	} else {
+		if ((ret = recv_xfer(sizeof *more)) || (ret = poll_all_recvs())) {
+			return ret;
+		}
+		*more = *(int *) buf;
+	}
+	return 0;
+}
+
+static int run_soak(void)
+{
+	double deadline;
+	int ret = 0, more = 1;
+
+	if (client && (ret = soak_init(&soak, SOAK_SAMPLES))) {
+		return ret;
+	}
+
+	soak_start = get_usec();
+	deadline = soak_start + soak_time * 1000000.;
+	soak_next = soak_start + soak_interval * 1000000.;
+	while (more) {
+		if (client) {
+			ret = send_stream();
+		} else if (two_sided()) {
+			ret = recv_stream();
+		}
+		if (ret) {
+			goto out;
+		}
+
+		if (client) {
+			more = get_usec() < deadline;
+		}
+		if ((ret = soak_continue(&more))) {
+			goto out;
+		}
+	}
+
+	if (client && soak.cnt) {
+		soak_report(&soak, soak_start);
+	}
+	if (verify) {
+		printf("verify: %ld errors, %.1f%% of run time\n", verify_errors,
+		       100. * verify_usec / (get_usec() - soak_start));
+	}
+out:
+	if (client) {
+		soak_free(&soak);
+	}
+	return ret;
+}
+
+static int run_iov(int cnt)
+{
+	char name[24];
+	int ret = 0;
+
+	init_iov(cnt);
+	if (verify) {
+		init_verify();
+	}
 	if ((ret = sync_test())) {
 		goto out;
 	}
 
-	if (bidir || client) {
-		gettimeofday(&start, NULL);
-		for (i = 0; i < iterations; i++) {
-			if ((ret = write_xfer(transfer_size))) {
-				goto out;
-			}
+	if (soak_time) {
+		if ((ret = run_soak())) {
+			goto out;
 		}
-		if ((ret = poll_all_sends())) {
+	} else if (bidir) {
+		if ((ret = bidir_stream())) {
+			goto out;
+		}
+		if ((ret = show_bidir_perf())) {
+			goto out;
+		}
+	} else if (client) {
+		if ((ret = send_stream())) {
+			goto out;
+		}
+		show_perf(test_name);
+	} else if (two_sided()) {
+		if ((ret = recv_stream())) {
 			goto out;
 		}
-		gettimeofday(&end, NULL);
-		show_perf();
+		snprintf(name, sizeof name, "%s_rx", test_name);
+		show_perf(name);
 	}
 
 	if ((ret = sync_test())) {
@@ -298,9 +998,26 @@ out:
 	return ret;
 }
 
+/* A sweep starts with the contiguous transfer as the baseline. */
+static int run_test(void)
+{
+	int cnt, ret;
+
+	if (iov_option >= 0)
+		return run_iov(iov_option);
+
+	for (cnt = 0; cnt <= iov_limit; cnt = cnt ? cnt << 1 : 1) {
+		if ((ret = run_iov(cnt))) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
 static void free_lres(void)
 {
 	fi_close(&cmeq->fid);
+	cmeq = NULL;
 }
 
 static int alloc_cm_res(void)
@@ -320,7 +1037,8 @@ static int alloc_cm_res(void)
 static void free_ep_res(void)
 {
 	fi_close(&mr->fid);
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 	fi_close(&scq->fid);
 	free(buf);
 }
@@ -330,33 +1048,56 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_cq_attr cq_attr;
 	int ret;
 
-	buffer_size = !custom ? test_size[TEST_CNT - 1].size : transfer_size;
+	buffer_size = !custom ? max_test_size(size_option) : transfer_size;
 	if (buffer_size < MIN_BUF_SIZE) {
 		buffer_size = MIN_BUF_SIZE;
 	}
-	buf = malloc(buffer_size);
-	if (!buf) {
-		perror("malloc");
+	if (iov_option) {
+		buffer_size += (size_t) MAX_IOV * iov_align;
+	}
+	if (verify) {
+		buffer_size = MAX(buffer_size, VERIFY_BUF_SIZE) + MIN_BUF_SIZE;
+	}
+	buffer_size += CTRL_SIZE;
+	if (posix_memalign(&buf, MAX(iov_align, (int) sizeof(void *)), buffer_size)) {
+		perror("posix_memalign");
 		return -1;
 	}
 
+	iov_limit = MIN(fi->tx_attr->iov_limit, MAX_IOV);
+	if (iov_option > iov_limit) {
+		printf("--iov=%d exceeds the provider iov_limit, using %d\n",
+			iov_option, iov_limit);
+		iov_option = iov_limit;
+	}
+
 	memset(&cq_attr, 0, sizeof cq_attr);
-	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.format = cq_format;
 	cq_attr.wait_obj = FI_WAIT_NONE;
-	cq_attr.size = max_credits << 1;
+	if (!cq_size) {
+		cq_size = max_credits << 1;
+		if (cq_mode == CQ_SHARED)
+			cq_size += max_credits;
+	}
+	cq_attr.size = cq_size;
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
 	if (ret) {
 		printf("fi_eq_open send comp %s\n", fi_strerror(-ret));
 		goto err1;
 	}
 
-	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
-	if (ret) {
-		printf("fi_eq_open recv comp %s\n", fi_strerror(-ret));
-		goto err2;
+	if (cq_mode == CQ_SHARED) {
+		rcq = scq;
+	} else {
+		ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+		if (ret) {
+			printf("fi_eq_open recv comp %s\n", fi_strerror(-ret));
+			goto err2;
+		}
 	}
 
-	ret = fi_mr_reg(dom, buf, buffer_size, FI_REMOTE_WRITE, 0, 0, 0, &mr, NULL);
+	ret = fi_mr_reg(dom, buf, buffer_size, FI_REMOTE_WRITE | FI_REMOTE_READ,
+			0, 0, 0, &mr, NULL);
 	if (ret) {
 		printf("fi_mr_reg %s\n", fi_strerror(-ret));
 		goto err3;
@@ -373,7 +1114,8 @@ static int alloc_ep_res(struct fi_info *fi)
 err4:
 	fi_close(&mr->fid);
 err3:
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 err2:
 	fi_close(&scq->fid);
 err1:
@@ -389,13 +1131,16 @@ static int bind_ep_res(void)
 	if (ret)
 		return ret;
 
-	ret = bind_fid(&ep->fid, &scq->fid, FI_SEND);
+	ret = bind_fid(&ep->fid, &scq->fid, FI_SEND | FI_WRITE | FI_READ |
+		       (rcq == scq ? FI_RECV : 0));
 	if (ret)
 		return ret;
 
-	ret = bind_fid(&ep->fid, &rcq->fid, FI_RECV);
-	if (ret)
-		return ret;
+	if (rcq != scq) {
+		ret = bind_fid(&ep->fid, &rcq->fid, FI_RECV);
+		if (ret)
+			return ret;
+	}
 
 	ret = fi_enable(ep);
 	if (ret)
@@ -404,12 +1149,22 @@ static int bind_ep_res(void)
 	return ret;
 }
 
+static char *sweep_port(void)
+{
+	static char str[16];
+
+	if (!cq_index)
+		return port;
+	snprintf(str, sizeof str, "%d", atoi(port) + cq_index);
+	return str;
+}
+
 static int server_listen(void)
 {
 	struct fi_info *fi;
 	int ret;
 
-	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, 0, &hints, &fi);
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, sweep_port(), 0, &hints, &fi);
 	if (ret) {
 		printf("fi_getinfo %s\n", strerror(-ret));
 		return ret;
@@ -542,7 +1297,7 @@ static int client_connect(void)
 			printf("source address error %s\n", gai_strerror(ret));
 	}
 
-	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, sweep_port(), 0, &hints, &fi);
 	if (ret) {
 		printf("fi_getinfo %s\n", strerror(-ret));
 		goto err0;
@@ -584,14 +1339,15 @@ static int client_connect(void)
 	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
 	if (rd != sizeof entry) {
 		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
-		return (int) rd;
+		ret = (int) rd;
+		goto err5;
 	}
 
 	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
 		printf("Unexpected CM event %d fid %p (ep %p)\n",
 			event, entry.fid, ep);
 		ret = -FI_EOTHER;
-		goto err1;
+		goto err5;
 	}
 
 	if (hints.src_addr)
@@ -615,9 +1371,54 @@ err0:
 	return ret;
 }
 
+static void show_header(void)
+{
+	if (cq_format != FI_CQ_FORMAT_CONTEXT)
+		printf("cq format: %s (%zu byte entries)\n",
+		       cq_format_str(cq_format), cq_entry_size(cq_format));
+
+	if (soak_time) {
+		if (client) {
+			soak_header();
+		}
+		return;
+	}
+
+	printf("%-10s%-8s%-8s%-8s%8s %10s%13s",
+	       "name", "bytes", "iters", "total", "time", "MB/sec", "usec/xfer");
+	if (verify) {
+		printf("%8s%8s", "errors", "verify");
+	}
+	if (cq_mode) {
+		printf("%10s%11s%9s", "Mmsg/s", "polls/msg", "empty");
+	}
+	if (window_list || cq_list) {
+		printf("%8s%8s", "cq", "window");
+	}
+	printf("%8s\n", "eagain");
+}
+
+static int run_sizes(void)
+{
+	int i, ret;
+
+	if (custom)
+		return run_test();
+
+	for (i = 0; i < TEST_CNT; i++) {
+		if (test_size[i].option > size_option)
+			continue;
+		init_test(test_size[i].size);
+		ret = run_test();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 static int run(void)
 {
-	int i, ret = 0;
+	int w, tries, ret = 0;
 
 	if (!client) {
 		ret = server_listen();
@@ -625,41 +1426,75 @@ static int run(void)
 			return ret;
 	}
 
-	printf("%-8s%-8s%-8s%8s %10s%13s\n",
-	       "bytes", "iters", "total", "time", "MB/sec", "usec/xfer");
+	if (!cq_index) {
+		show_header();
+	}
+
+	cq_size = cq_list ? cq_list[cq_index].size : 0;
+	max_credits = send_credits = recv_credits = window_max;
 
+	/*
+	 * The server only listens for the next CQ size once it is done
+	 * with the previous one, so the client retries for a while.
+	 */
 	ret = client ? client_connect() : server_connect();
+	for (tries = 0; ret && client && cq_index && tries < 50; tries++) {
+		if (cmeq)
+			free_lres();
+		usleep(100000);
+		ret = client_connect();
+	}
 	if (ret)
 		return ret;
 
-	if (!custom) {
-		for (i = 0; i < TEST_CNT; i++) {
-			if (test_size[i].option > size_option)
-				continue;
-			init_test(test_size[i].size);
-			ret = run_test();
-		}
+	if (soak_time) {
+		init_test(custom ? transfer_size : SOAK_SIZE);
+		ret = run_test();
 	} else {
+		for (w = 0; !ret && w < window_cnt; w++) {
+			if (window_list) {
+				max_credits = send_credits = recv_credits =
+					window_list[w].size;
+			}
+			ret = run_sizes();
+		}
+	}
 
-		ret = run_test();
+	if (cq_overruns()) {
+		printf("%ld cq overruns with %d entries\n", cq_overruns(), cq_size);
 	}
 
 	fi_shutdown(ep, 0);
 	fi_close(&ep->fid);
 	free_ep_res();
-	if (!client)
+	if (!client || cq_list)
 		free_lres();
+	if (!client && cq_list)
+		fi_close(&pep->fid);
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
 	return ret;
 }
 
+static int str2op(char *str)
+{
+	int i;
+
+	for (i = 0; i < OP_MAX; i++) {
+		if (!strcasecmp(op_str[i], str)) {
+			op = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
 int main(int argc, char **argv)
 {
-	int op, ret;
+	int opt, i, ret = 0;
 
-	while ((op = getopt(argc, argv, "d:p:s:C:I:S:b")) != -1) {
-		switch (op) {
+	while ((opt = getopt_long(argc, argv, "d:p:s:C:F:I:S:bo:q:W:Q:", longopts, NULL)) != -1) {
+		switch (opt) {
 		case 'd':
 			dst_addr = optarg;
 			client = true;
@@ -676,37 +1511,128 @@ int main(int argc, char **argv)
 			break;
 		case 'S':
 			if (!strncasecmp("all", optarg, 3)) {
-				size_option = 1;
-			} else if (!strncasecmp("ext", optarg, 3)) {
-				size_option = 2;
+				size_option = SIZE_OPT_ALL;
+			} else if (strpbrk(optarg, ":,")) {
+				if (set_test_sizes(optarg))
+					exit(1);
 			} else {
 				custom = 1;
-				transfer_size = atoi(optarg);
+				if (parse_transfer_size(optarg, &transfer_size))
+					exit(1);
 			}
 			break;
 		case 'b':
 			bidir = true;
 			break;
+		case 'o':
+			if (str2op(optarg))
+				goto usage;
+			break;
+		case 'v':
+			if (!strcasecmp("sweep", optarg)) {
+				iov_option = -1;
+			} else {
+				iov_option = atoi(optarg);
+				if (iov_option < 1 || iov_option > MAX_IOV) {
+					printf("--iov must be between 1 and %d\n", MAX_IOV);
+					goto usage;
+				}
+			}
+			break;
+		case 'A':
+			iov_align = atoi(optarg);
+			if (iov_align < 1 || (iov_align & (iov_align - 1))) {
+				printf("--iov-align must be a power of 2\n");
+				goto usage;
+			}
+			break;
+		case 'H':
+			iov_hdr = atoi(optarg);
+			break;
+		case 'V':
+			verify = true;
+			break;
+		case 'T':
+			soak_time = atoi(optarg);
+			break;
+		case 'i':
+			soak_interval = atoi(optarg);
+			if (soak_interval < 1) {
+				printf("--interval must be at least 1 second\n");
+				goto usage;
+			}
+			break;
+		case 'F':
+			if (str_to_cq_format(optarg, &cq_format))
+				goto usage;
+			break;
+		case 'q':
+			cq_mode = str_to_cq_mode(optarg);
+			if (cq_mode < 0)
+				goto usage;
+			break;
+		case 'W':
+			if (parse_size_list(optarg, &window_list, &window_cnt))
+				goto usage;
+			break;
+		case 'Q':
+			if (parse_size_list(optarg, &cq_list, &cq_cnt))
+				goto usage;
+			break;
 		default:
+usage:
 			printf("usage: %s\n", argv[0]);
 			printf("\t[-d destination_address] (client only)\n");
 			printf("\t[-p port_number] (default: 9228)\n");
 			printf("\t[-s source_address]\n");
 			printf("\t[-I iterations] (default: dynamic)\n");
-			printf("\t[-S transfer_size or 'all' or 'ext'] (default: all)\n");
-			printf("\t[-b ] Bidirectional transfer (default: disabled)\n");
+			printf("\t[-S transfer_size or 'all']\n");
+			printf("\t[-S start:end[:xN|:+N][,...]] size sweep, e.g. 64:1m:x2\n");
+			printf("\t[-b ] Simultaneous bidirectional transfer (default: disabled)\n");
+			printf("\t[-o, --op=send|write|read|writedata|sendmsg] (default: write)\n");
+			printf("\t[--iov=segments or 'sweep'] (default: contiguous)\n");
+			printf("\t[--iov-align=bytes] segment start alignment (default: 1)\n");
+			printf("\t[--iov-hdr=bytes] size of the first (header) segment\n");
+			printf("\t[--verify] check received payloads (send only)\n");
+			printf("\t[--time=seconds] soak at one size (default: 64k), reporting every interval\n");
+			printf("\t[--interval=seconds] soak report interval (default: 1)\n");
+			printf("\t[-F, --cq-format=context|msg|data|tagged] cq entry format (default: context)\n");
+			printf("\t[-q, --cq=split|shared] separate send and receive cqs or one for both,\n");
+			printf("\t\treporting message rate and cq polls per message (default: split)\n");
+			printf("\t[-W, --window=credits or list] transfers in flight, e.g. 16:1k:x2 (default: 128)\n");
+			printf("\t[-Q, --cq-size=entries or list] cq size, e.g. 64:4k:x2, one connection\n");
+			printf("\t\teach on port + n (default: twice the window)\n");
 			exit(1);
 		}
 	}
 
+	if (verify && (op != OP_SEND || iov_option)) {
+		printf("--verify needs --op=send without --iov\n");
+		exit(1);
+	}
+
+	if (soak_time && bidir) {
+		printf("--time does not support bidirectional transfers\n");
+		exit(1);
+	}
+
+	if (window_list) {
+		window_max = 0;
+		for (i = 0; i < window_cnt; i++)
+			window_max = MAX(window_max, window_list[i].size);
+	}
+
 	hints.domain_attr = &domain_hints;
 	hints.ep_attr = &ep_hints;
 	hints.ep_type = FI_EP_MSG;
 	hints.caps = FI_RMA | FI_MSG;
+	if (op == OP_WRITEDATA)
+		hints.caps |= FI_REMOTE_CQ_DATA;
 	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
 	domain_hints.name = BW_DOMAIN_NAME;
 	hints.addr_format = FI_SOCKADDR;
 
-	ret = run();
+	for (cq_index = 0; !ret && cq_index < cq_cnt; cq_index++)
+		ret = run();
 	return ret;
 }
@@ -0,0 +1,856 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Cycles spent in single data path calls on a connected endpoint.  The
+ * client times each call with the cycle counter and reports percentiles
+ * per call: posting fi_send, fi_inject, fi_write and fi_recv, fi_cq_read
+ * on an empty queue and when it returns a single or a full window of
+ * entries, and fi_mr_desc.  Calls are made in batches of a window, and
+ * only the calls themselves are timed, not the waits between batches.
+ *
+ * The server acks every window of messages and answers reply requests
+ * with a window of messages to consume the client's timed receives.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_rma.h>
+#include <rdma/fi_cm.h>
+#include <shared.h>
+
+#define MAX_WINDOW 256
+
+enum msg_type {
+	MSG_DATA,
+	MSG_REPLY,
+	MSG_DONE
+};
+
+enum call {
+	CALL_SEND,
+	CALL_INJECT,
+	CALL_WRITE,
+	CALL_RECV,
+	CALL_CQ_EMPTY,
+	CALL_CQ_ONE,
+	CALL_CQ_WINDOW,
+	CALL_MR_DESC,
+	CALL_MAX
+};
+
+static const char *call_str[] = {
+	[CALL_SEND] = "fi_send",
+	[CALL_INJECT] = "fi_inject",
+	[CALL_WRITE] = "fi_write",
+	[CALL_RECV] = "fi_recv",
+	[CALL_CQ_EMPTY] = "cq_read(0)",
+	[CALL_CQ_ONE] = "cq_read(1)",
+	[CALL_CQ_WINDOW] = "cq_read(w)",
+	[CALL_MR_DESC] = "fi_mr_desc",
+};
+
+static int iterations = 10000;
+static int transfer_size = 8;
+static int window = 16;
+static int send_credits;
+static double *samples[CALL_MAX];
+static int sample_cnt[CALL_MAX];
+static size_t inject_size;
+static void *buf, *tx_buf, *rx_buf, *rma_buf;
+static size_t buffer_size;
+static uint64_t rem_addr, rem_key;
+static void *volatile desc;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *dst_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_pep *pep;
+static struct fid_domain *dom;
+static struct fid_ep *ep;
+static struct fid_eq *cmeq;
+static struct fid_cq *rcq, *scq;
+static struct fid_mr *mr;
+
+static void add_sample(enum call call, uint64_t start)
+{
+	uint64_t cycles = get_cycles() - start;
+
+	if (sample_cnt[call] < iterations)
+		samples[call][sample_cnt[call]++] = (double) cycles;
+}
+
+/* Cycles per usec, over 10 msec of spinning. */
+static double cycles_per_usec(void)
+{
+	double start = get_usec();
+	uint64_t c0 = get_cycles();
+
+	while (get_usec() - start < 10000)
+		;
+	return (get_cycles() - c0) / (get_usec() - start);
+}
+
+static void show_results(void)
+{
+	double rate = cycles_per_usec(), *s;
+	int call, n;
+
+	printf("%-12s%8s%10s%10s%10s%10s%10s%10s%10s\n", "call", "calls",
+	       "min", "p50", "p90", "p99", "p99.9", "max", "p50 ns");
+	for (call = 0; call < CALL_MAX; call++) {
+		s = samples[call];
+		n = sample_cnt[call];
+		printf("%-12s%8d", call_str[call], n);
+		if (!n) {
+			printf("%10s\n", "-");
+			continue;
+		}
+
+		qsort(s, n, sizeof *s, cmp_double);
+		printf("%10.0f%10.0f%10.0f%10.0f%10.0f%10.0f%10.1f\n", s[0],
+		       percentile(s, n, 0.5), percentile(s, n, 0.9),
+		       percentile(s, n, 0.99), percentile(s, n, 0.999),
+		       s[n - 1], percentile(s, n, 0.5) * 1000 / rate);
+	}
+	printf("%.0f cycles per usec, window %d, %d byte messages\n",
+	       rate, window, transfer_size);
+}
+
+static int post_recv(void)
+{
+	int ret;
+
+	ret = fi_recv(ep, rx_buf, buffer_size, fi_mr_desc(mr), rx_buf);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int post_send(size_t size)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	while (!send_credits) {
+		ret = fi_cq_read(scq, &comp, 1);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+		send_credits += ret;
+	}
+
+	ret = fi_send(ep, tx_buf, size, fi_mr_desc(mr), NULL);
+	if (ret)
+		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
+	else
+		send_credits--;
+	return ret;
+}
+
+/* Reaps send completions until all credits are back, timing each read. */
+static int drain_sends(void)
+{
+	struct fi_cq_entry comp[MAX_WINDOW];
+	uint64_t start;
+	int ret;
+
+	while (send_credits < window) {
+		start = get_cycles();
+		ret = fi_cq_read(scq, comp, window - send_credits);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+		if (ret == 1)
+			add_sample(CALL_CQ_ONE, start);
+		else if (ret == window)
+			add_sample(CALL_CQ_WINDOW, start);
+		send_credits += ret;
+	}
+	return 0;
+}
+
+/* Waits for one message, replacing its receive if repost is set. */
+static int wait_recv(int repost)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	do {
+		ret = fi_cq_read(rcq, &comp, 1);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+	} while (!ret);
+
+	return repost ? post_recv() : 0;
+}
+
+static int send_ctrl(enum msg_type type)
+{
+	*(int *) tx_buf = type;
+	return post_send(MAX(transfer_size, sizeof(int)));
+}
+
+static int server_test(void)
+{
+	int ret, i, cnt = 0;
+
+	/* the client writes into the RMA region */
+	((uint64_t *) tx_buf)[0] = (uintptr_t) rma_buf;
+	((uint64_t *) tx_buf)[1] = fi_mr_key(mr);
+	ret = post_send(2 * sizeof(uint64_t));
+	if (ret)
+		return ret;
+
+	for (;;) {
+		ret = wait_recv(1);
+		if (ret)
+			return ret;
+
+		switch (*(int *) rx_buf) {
+		case MSG_DATA:
+			if (++cnt < window)
+				break;
+			cnt = 0;
+			ret = send_ctrl(MSG_DATA);
+			break;
+		case MSG_REPLY:
+			for (i = 0; !ret && i < window; i++)
+				ret = send_ctrl(MSG_DATA);
+			break;
+		default:
+			return send_ctrl(MSG_DONE);
+		}
+		if (ret)
+			return ret;
+	}
+}
+
+static int time_sends(int inject)
+{
+	uint64_t start;
+	int ret, i, j;
+
+	*(int *) tx_buf = MSG_DATA;
+	for (i = 0; i < iterations; i += window) {
+		for (j = 0; j < window; j++) {
+			start = get_cycles();
+			if (inject) {
+				ret = fi_inject(ep, tx_buf, transfer_size);
+			} else {
+				ret = fi_send(ep, tx_buf, transfer_size,
+					      fi_mr_desc(mr), NULL);
+				send_credits--;
+			}
+			if (ret) {
+				printf("%s %d (%s)\n", inject ? "fi_inject" : "fi_send",
+				       ret, fi_strerror(-ret));
+				return ret;
+			}
+			add_sample(inject ? CALL_INJECT : CALL_SEND, start);
+		}
+
+		/* the ack means every message arrived */
+		ret = wait_recv(1);
+		if (!ret)
+			ret = drain_sends();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int time_writes(void)
+{
+	uint64_t start;
+	int ret, i, j;
+
+	for (i = 0; i < iterations; i += window) {
+		for (j = 0; j < window; j++) {
+			start = get_cycles();
+			ret = fi_write(ep, tx_buf, transfer_size, fi_mr_desc(mr),
+				       rem_addr, rem_key, NULL);
+			if (ret) {
+				printf("fi_write %d (%s)\n", ret, fi_strerror(-ret));
+				return ret;
+			}
+			add_sample(CALL_WRITE, start);
+			send_credits--;
+		}
+
+		ret = drain_sends();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int time_recvs(void)
+{
+	uint64_t start;
+	int ret, i, j;
+
+	for (i = 0; i < iterations; i += window) {
+		for (j = 0; j < window; j++) {
+			start = get_cycles();
+			ret = fi_recv(ep, rx_buf, buffer_size, fi_mr_desc(mr),
+				      rx_buf);
+			if (ret) {
+				printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+				return ret;
+			}
+			add_sample(CALL_RECV, start);
+		}
+
+		/* the server's reply consumes the receives just posted */
+		ret = send_ctrl(MSG_REPLY);
+		for (j = 0; !ret && j < window; j++)
+			ret = wait_recv(0);
+		if (!ret)
+			ret = drain_sends();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int client_test(void)
+{
+	struct fi_cq_entry comp;
+	uint64_t start;
+	int ret, i;
+
+	ret = wait_recv(1);
+	if (ret)
+		return ret;
+	rem_addr = ((uint64_t *) rx_buf)[0];
+	rem_key = ((uint64_t *) rx_buf)[1];
+
+	for (i = 0; i < iterations; i++) {
+		start = get_cycles();
+		ret = fi_cq_read(rcq, &comp, 1);
+		if (ret) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret < 0 ? ret : -FI_EOTHER;
+		}
+		add_sample(CALL_CQ_EMPTY, start);
+	}
+
+	for (i = 0; i < iterations; i++) {
+		start = get_cycles();
+		desc = fi_mr_desc(mr);
+		add_sample(CALL_MR_DESC, start);
+	}
+
+	ret = time_sends(0);
+	if (!ret && transfer_size <= inject_size)
+		ret = time_sends(1);
+	if (!ret)
+		ret = time_writes();
+	if (!ret)
+		ret = time_recvs();
+	if (ret)
+		return ret;
+
+	ret = send_ctrl(MSG_DONE);
+	if (!ret)
+		ret = wait_recv(1);
+	if (!ret)
+		ret = drain_sends();
+	if (!ret)
+		show_results();
+	return ret;
+}
+
+static void free_lres(void)
+{
+	fi_close(&cmeq->fid);
+}
+
+static int alloc_cm_res(void)
+{
+	struct fi_eq_attr cm_attr;
+	int ret;
+
+	memset(&cm_attr, 0, sizeof cm_attr);
+	cm_attr.wait_obj = FI_WAIT_FD;
+	ret = fi_eq_open(fab, &cm_attr, &cmeq, NULL);
+	if (ret)
+		printf("fi_eq_open cm %s\n", fi_strerror(-ret));
+
+	return ret;
+}
+
+static void free_ep_res(void)
+{
+	int i;
+
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	for (i = 0; i < CALL_MAX; i++)
+		free(samples[i]);
+	free(buf);
+}
+
+static int alloc_ep_res(struct fi_info *fi)
+{
+	struct fi_cq_attr cq_attr;
+	int ret, i;
+
+	inject_size = fi->tx_attr->inject_size;
+
+	/* separate send, receive and RMA target regions */
+	buffer_size = MAX(transfer_size, 2 * sizeof(uint64_t));
+	buf = calloc(3, buffer_size);
+	ret = buf ? 0 : -FI_ENOMEM;
+	for (i = 0; !ret && i < CALL_MAX; i++) {
+		samples[i] = calloc(iterations, sizeof *samples[i]);
+		if (!samples[i])
+			ret = -FI_ENOMEM;
+	}
+	if (ret) {
+		perror("malloc");
+		goto err1;
+	}
+	tx_buf = buf;
+	rx_buf = (char *) buf + buffer_size;
+	rma_buf = (char *) buf + 2 * buffer_size;
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = window << 1;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, 3 * buffer_size, FI_REMOTE_WRITE, 0, 0, 0,
+			&mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	if (!cmeq) {
+		ret = alloc_cm_res();
+		if (ret)
+			goto err4;
+	}
+
+	return 0;
+
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	for (i = 0; i < CALL_MAX; i++)
+		free(samples[i]);
+	free(buf);
+	return ret;
+}
+
+/*
+ * The server keeps a window of receives posted, the client one for acks
+ * besides those it times.
+ */
+static int bind_ep_res(void)
+{
+	int ret, i;
+
+	ret = fi_bind(&ep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND | FI_WRITE);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_enable(ep);
+	if (ret)
+		return ret;
+
+	send_credits = window;
+	for (i = 0; i < (dst_addr ? 1 : window); i++) {
+		ret = post_recv();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int server_listen(void)
+{
+	struct fi_info *fi;
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_pendpoint(fab, fi, &pep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_cm_res();
+	if (ret)
+		goto err2;
+
+	ret = fi_bind(&pep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = fi_listen(pep);
+	if (ret) {
+		printf("fi_listen %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	fi_freeinfo(fi);
+	return 0;
+err3:
+	free_lres();
+err2:
+	fi_close(&pep->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int server_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *info = NULL;
+	ssize_t rd;
+	int ret;
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		return (int) rd;
+	}
+
+	if (event != FI_CONNREQ) {
+		printf("Unexpected CM event %d\n", event);
+		ret = -FI_EOTHER;
+		goto err1;
+	}
+
+	info = entry.info;
+	ret = fi_domain(fab, info, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_endpoint(dom, info, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint for req %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_ep_res(info);
+	if (ret)
+		 goto err2;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err3;
+
+	ret = fi_accept(ep, NULL, 0);
+	if (ret) {
+		printf("fi_accept %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		goto err3;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err3;
+	}
+
+	fi_freeinfo(info);
+	return 0;
+
+err3:
+	free_ep_res();
+err2:
+	fi_close(&ep->fid);
+err1:
+	fi_reject(pep, info->connreq, NULL, 0);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int client_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *fi;
+	ssize_t rd;
+	int ret;
+
+	if (src_addr) {
+		ret = getaddr(src_addr, NULL, (struct sockaddr **) &hints.src_addr,
+			      (socklen_t *) &hints.src_addrlen);
+		if (ret)
+			printf("source address error %s\n", gai_strerror(ret));
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err2;
+	}
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err4;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err5;
+
+	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
+	if (ret) {
+		printf("fi_connect %s\n", fi_strerror(-ret));
+		goto err5;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_condread %zd %s\n", rd, fi_strerror((int) -rd));
+		ret = (int) rd;
+		goto err5;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err5;
+	}
+
+	if (hints.src_addr)
+		free(hints.src_addr);
+	fi_freeinfo(fi);
+	return 0;
+
+err5:
+	free_ep_res();
+err4:
+	fi_close(&ep->fid);
+err3:
+	fi_close(&dom->fid);
+err2:
+	fi_close(&fab->fid);
+err1:
+	fi_freeinfo(fi);
+err0:
+	if (hints.src_addr)
+		free(hints.src_addr);
+	return ret;
+}
+
+static int run(void)
+{
+	int ret;
+
+	if (!dst_addr) {
+		ret = server_listen();
+		if (ret)
+			return ret;
+	}
+
+	ret = dst_addr ? client_connect() : server_connect();
+	if (ret)
+		return ret;
+
+	ret = dst_addr ? client_test() : server_test();
+	if (!ret)
+		ret = drain_sends();
+
+	fi_shutdown(ep, 0);
+	fi_close(&ep->fid);
+	free_ep_res();
+	if (!dst_addr)
+		free_lres();
+	fi_close(&dom->fid);
+	fi_close(&fab->fid);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int op;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:I:S:w:")) != -1) {
+		switch (op) {
+		case 'd':
+			dst_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'I':
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			transfer_size = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (iterations < 1 || window < 1 || window > MAX_WINDOW ||
+	    transfer_size < (int) sizeof(int)) {
+		printf("iterations must be positive, window at most %d and "
+		       "transfer_size at least %zu\n", MAX_WINDOW, sizeof(int));
+		goto usage;
+	}
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_MSG;
+	hints.caps = FI_MSG | FI_RMA;
+	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
+	hints.addr_format = FI_SOCKADDR;
+
+	return run();
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d destination_address]\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p port_number]\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-I calls timed per kind (default 10000)]\n");
+	printf("\t[-S transfer_size (default 8)]\n");
+	printf("\t[-w calls per batch (default 16)]\n");
+	exit(1);
+}
@@ -0,0 +1,1185 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Collective operation microbenchmarks.  Barrier, broadcast, reduce
+ * and allreduce are built from point-to-point transfers over reliable
+ * datagram endpoints, using either tagged sends or RMA writes with
+ * remote CQ data.  Ranks are bootstrapped through the TCP rendezvous
+ * used by fi_traffic.
+ *
+ * Every collective round lands in its own slot of the receive region,
+ * and iterations are separated by an untimed dissemination barrier, so
+ * no rank can overwrite data that a slower peer still needs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_cm.h>
+#include <rdma/fi_rma.h>
+#include <rdma/fi_tagged.h>
+#include <shared.h>
+
+#define MAX_ADDR_LEN	64
+#define COLL_MAX_SIZE	(1 << 20)
+#define MAX_SEGS	8
+#define BCAST_BASE	32
+#define SYNC_BASE	(max_rounds)
+#define TAG_SYNC	(1ULL << 32)
+
+enum coll_op {
+	OP_BARRIER,
+	OP_BCAST,
+	OP_REDUCE,
+	OP_ALLREDUCE,
+	OP_MAX
+};
+
+enum coll_alg {
+	ALG_TREE,
+	ALG_RD,
+	ALG_RING,
+	ALG_MAX
+};
+
+static const char *op_str[] = {
+	[OP_BARRIER] = "barrier",
+	[OP_BCAST] = "bcast",
+	[OP_REDUCE] = "reduce",
+	[OP_ALLREDUCE] = "allreduce",
+};
+
+static const char *alg_str[] = {
+	[ALG_TREE] = "tree",
+	[ALG_RD] = "rd",
+	[ALG_RING] = "ring",
+};
+
+/* algorithms implemented for each operation */
+static const int op_algs[OP_MAX][ALG_MAX] = {
+	[OP_BARRIER] = { 1, 1, 1 },
+	[OP_BCAST] = { 1, 0, 1 },
+	[OP_REDUCE] = { 1, 0, 1 },
+	[OP_ALLREDUCE] = { 1, 1, 1 },
+};
+
+struct rma_peer {
+	uint64_t addr;
+	uint64_t key;
+};
+
+static int custom;
+static int custom_iterations;
+static int size_option = SIZE_OPT_DEFAULT;
+static int iterations;
+static int transfer_size;
+static int sel_op = -1, sel_alg = -1;
+static int use_rma;
+static int scaling;
+static int rank, nranks = 2, gsize;
+static int max_rounds;
+static int outstanding;
+static int *arrived;
+static int *round_ctx;
+static int note_ctx;
+static int errors;
+static float *all_usec;
+
+static void *buf;
+static double *acc;
+static char *slots, *sync_buf, *note_buf;
+static size_t buffer_size, region_size;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *rdv_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_domain *dom;
+static struct fid_ep *ep;
+static struct fid_av *av;
+static struct fid_cq *rcq, *scq;
+static struct fid_mr *mr;
+static fi_addr_t *addrs;
+static struct rma_peer *peers;
+
+static void *slot(int round)
+{
+	return slots + (size_t) round * buffer_size;
+}
+
+static int post_note_recv(void)
+{
+	int ret;
+
+	ret = fi_recv(ep, note_buf, sizeof(uint64_t), fi_mr_desc(mr), &note_ctx);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int progress(void)
+{
+	struct fi_cq_data_entry comp[8];
+	int ret, i;
+
+	ret = fi_cq_read(scq, comp, 8);
+	if (ret > 0) {
+		outstanding -= ret;
+	} else if (ret < 0) {
+		printf("Send queue read %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_cq_read(rcq, comp, 8);
+	if (ret < 0) {
+		printf("Recv queue read %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+
+	for (i = 0; i < ret; i++) {
+		if (comp[i].op_context == &note_ctx) {
+			arrived[comp[i].data]++;
+			if (post_note_recv())
+				return -FI_EOTHER;
+		} else {
+			arrived[(int *) comp[i].op_context - round_ctx]++;
+		}
+	}
+	return 0;
+}
+
+static int post_recv(int round, size_t len)
+{
+	int ret;
+
+	/* RMA data is written straight into the slot */
+	if (use_rma)
+		return 0;
+
+	ret = fi_trecv(ep, slot(round), len, fi_mr_desc(mr), round, 0,
+		       &round_ctx[round]);
+	if (ret)
+		printf("fi_trecv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int post_send(int peer, int round, void *data, size_t len)
+{
+	int ret;
+
+	if (use_rma) {
+		ret = fi_writedatato(ep, data, len, fi_mr_desc(mr), round,
+				     addrs[peer], peers[peer].addr +
+				     (size_t) round * buffer_size,
+				     peers[peer].key, NULL);
+		if (ret)
+			printf("fi_writedatato %d (%s)\n", ret, fi_strerror(-ret));
+	} else {
+		ret = fi_tsendto(ep, data, len, fi_mr_desc(mr), addrs[peer],
+				 round, NULL);
+		if (ret)
+			printf("fi_tsendto %d (%s)\n", ret, fi_strerror(-ret));
+	}
+
+	if (!ret)
+		outstanding++;
+	return ret;
+}
+
+static int wait_round(int round)
+{
+	int ret;
+
+	while (!arrived[round]) {
+		ret = progress();
+		if (ret)
+			return ret;
+	}
+	arrived[round]--;
+	return 0;
+}
+
+static int wait_sends(void)
+{
+	int ret;
+
+	while (outstanding) {
+		ret = progress();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int xchg(int to, int from, int round, void *data, size_t len)
+{
+	int ret;
+
+	ret = post_recv(round, len);
+	if (ret)
+		return ret;
+
+	ret = post_send(to, round, data, len);
+	if (ret)
+		return ret;
+
+	ret = wait_round(round);
+	if (ret)
+		return ret;
+
+	return wait_sends();
+}
+
+static void sum(double *dst, double *src, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		dst[i] += src[i];
+}
+
+/*
+ * Untimed dissemination barrier across all ranks, always over tagged
+ * messages, separating iterations of the collective under test.
+ */
+static int sync_ranks(void)
+{
+	int mask, k, ret;
+
+	for (mask = 1, k = 0; mask < nranks; mask <<= 1, k++) {
+		ret = fi_trecv(ep, sync_buf, 0, fi_mr_desc(mr), TAG_SYNC | k, 0,
+			       &round_ctx[SYNC_BASE + k]);
+		if (ret) {
+			printf("fi_trecv %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+
+		ret = fi_tsendto(ep, sync_buf, 0, fi_mr_desc(mr),
+				 addrs[(rank + mask) % nranks], TAG_SYNC | k, NULL);
+		if (ret) {
+			printf("fi_tsendto %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+		outstanding++;
+
+		ret = wait_round(SYNC_BASE + k);
+		if (ret)
+			return ret;
+
+		ret = wait_sends();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int barrier_rd(void)
+{
+	int mask, k, ret;
+
+	for (mask = 1, k = 0; mask < gsize; mask <<= 1, k++) {
+		ret = xchg((rank + mask) % gsize, (rank - mask + gsize) % gsize,
+			   k, acc, 0);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int barrier_ring(void)
+{
+	int lap, ret;
+
+	for (lap = 0; lap < 2; lap++) {
+		ret = post_recv(lap, 0);
+		if (ret)
+			return ret;
+
+		if (rank) {
+			ret = wait_round(lap);
+			if (ret)
+				return ret;
+		}
+
+		ret = post_send((rank + 1) % gsize, lap, acc, 0);
+		if (ret)
+			return ret;
+
+		if (!rank) {
+			ret = wait_round(lap);
+			if (ret)
+				return ret;
+		}
+
+		ret = wait_sends();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* binomial tree rooted at rank 0, round k moves data across distance 2^k */
+static int bcast_tree(int base, void **data, size_t len)
+{
+	int mask, round, ret;
+
+	for (mask = 1; mask < gsize; mask <<= 1) {
+		if (rank & mask) {
+			round = base + __builtin_ctz(mask);
+			ret = post_recv(round, len);
+			if (ret)
+				return ret;
+			ret = wait_round(round);
+			if (ret)
+				return ret;
+			*data = slot(round);
+			break;
+		}
+	}
+
+	for (mask >>= 1; mask > 0; mask >>= 1) {
+		if (rank + mask < gsize) {
+			ret = post_send(rank + mask, base + __builtin_ctz(mask),
+					*data, len);
+			if (ret)
+				return ret;
+		}
+	}
+	return wait_sends();
+}
+
+static int reduce_tree(int base, size_t count)
+{
+	int mask, round, ret;
+
+	for (mask = 1; mask < gsize; mask <<= 1) {
+		round = base + __builtin_ctz(mask);
+		if (rank & mask) {
+			ret = post_send(rank - mask, round, acc, count * sizeof *acc);
+			if (ret)
+				return ret;
+			return wait_sends();
+		}
+
+		if (rank + mask < gsize) {
+			ret = post_recv(round, count * sizeof *acc);
+			if (ret)
+				return ret;
+			ret = wait_round(round);
+			if (ret)
+				return ret;
+			sum(acc, slot(round), count);
+		}
+	}
+	return 0;
+}
+
+static int segments(size_t len)
+{
+	return len ? MIN(MAX_SEGS, len) : 1;
+}
+
+/* chain from rank 0 upward, pipelined in segments */
+static int bcast_ring(void *data, size_t len)
+{
+	size_t seg, off, l;
+	void *src;
+	int nseg, s, ret;
+
+	nseg = segments(len);
+	seg = (len + nseg - 1) / nseg;
+
+	for (s = 0; rank && s < nseg; s++) {
+		off = s * seg;
+		ret = post_recv(s, off < len ? MIN(seg, len - off) : 0);
+		if (ret)
+			return ret;
+	}
+
+	for (s = 0; s < nseg; s++) {
+		off = s * seg;
+		l = off < len ? MIN(seg, len - off) : 0;
+		if (rank) {
+			ret = wait_round(s);
+			if (ret)
+				return ret;
+			src = slot(s);
+		} else {
+			src = (char *) data + off;
+		}
+
+		if (rank + 1 < gsize) {
+			ret = post_send(rank + 1, s, src, l);
+			if (ret)
+				return ret;
+		}
+	}
+	return wait_sends();
+}
+
+/* chain from the last rank down to rank 0, pipelined in segments */
+static int reduce_ring(size_t count)
+{
+	size_t seg, off, l;
+	int nseg, s, ret;
+
+	nseg = segments(count);
+	seg = (count + nseg - 1) / nseg;
+
+	for (s = 0; rank < gsize - 1 && s < nseg; s++) {
+		off = s * seg;
+		ret = post_recv(s, (off < count ? MIN(seg, count - off) : 0) *
+				sizeof *acc);
+		if (ret)
+			return ret;
+	}
+
+	for (s = 0; s < nseg; s++) {
+		off = s * seg;
+		l = off < count ? MIN(seg, count - off) : 0;
+		if (rank < gsize - 1) {
+			ret = wait_round(s);
+			if (ret)
+				return ret;
+			sum(acc + off, slot(s), l);
+		}
+
+		if (rank) {
+			ret = post_send(rank - 1, s, acc + off, l * sizeof *acc);
+			if (ret)
+				return ret;
+		}
+	}
+	return wait_sends();
+}
+
+/*
+ * Recursive doubling.  Ranks beyond the largest power of two first fold
+ * their data into a partner and get the result back at the end.
+ */
+static int allreduce_rd(size_t count)
+{
+	size_t len = count * sizeof *acc;
+	int p2, extra, mask, k, ret;
+
+	for (p2 = 1; p2 << 1 <= gsize; p2 <<= 1)
+		;
+	extra = gsize - p2;
+
+	if (rank >= p2) {
+		ret = post_recv(1, len);
+		if (ret)
+			return ret;
+		ret = post_send(rank - p2, 0, acc, len);
+		if (ret)
+			return ret;
+		ret = wait_sends();
+		if (ret)
+			return ret;
+		ret = wait_round(1);
+		if (ret)
+			return ret;
+		memcpy(acc, slot(1), len);
+		return 0;
+	}
+
+	if (rank < extra) {
+		ret = post_recv(0, len);
+		if (ret)
+			return ret;
+		ret = wait_round(0);
+		if (ret)
+			return ret;
+		sum(acc, slot(0), count);
+	}
+
+	for (mask = 1, k = 2; mask < p2; mask <<= 1, k++) {
+		ret = xchg(rank ^ mask, rank ^ mask, k, acc, len);
+		if (ret)
+			return ret;
+		sum(acc, slot(k), count);
+	}
+
+	if (rank < extra) {
+		ret = post_send(rank + p2, 1, acc, len);
+		if (ret)
+			return ret;
+		ret = wait_sends();
+	}
+	return ret;
+}
+
+static size_t chunk_off(int c, size_t count)
+{
+	return MIN((size_t) c * ((count + gsize - 1) / gsize), count);
+}
+
+static size_t chunk_len(int c, size_t count)
+{
+	return chunk_off(c + 1, count) - chunk_off(c, count);
+}
+
+/* reduce-scatter followed by allgather around the ring */
+static int allreduce_ring(size_t count)
+{
+	size_t off, l;
+	int right, s, c, ret;
+
+	right = (rank + 1) % gsize;
+
+	for (s = 0; s < gsize - 1; s++) {
+		c = (rank - s - 1 + 2 * gsize) % gsize;
+		ret = post_recv(s, chunk_len(c, count) * sizeof *acc);
+		if (ret)
+			return ret;
+
+		c = (rank - s + 2 * gsize) % gsize;
+		ret = post_send(right, s, acc + chunk_off(c, count),
+				chunk_len(c, count) * sizeof *acc);
+		if (ret)
+			return ret;
+
+		ret = wait_round(s);
+		if (ret)
+			return ret;
+		ret = wait_sends();
+		if (ret)
+			return ret;
+
+		c = (rank - s - 1 + 2 * gsize) % gsize;
+		sum(acc + chunk_off(c, count), slot(s), chunk_len(c, count));
+	}
+
+	for (s = 0; s < gsize - 1; s++) {
+		c = (rank - s + 2 * gsize) % gsize;
+		off = chunk_off(c, count);
+		l = chunk_len(c, count);
+		ret = post_recv(gsize - 1 + s, l * sizeof *acc);
+		if (ret)
+			return ret;
+
+		c = (rank + 1 - s + 2 * gsize) % gsize;
+		ret = post_send(right, gsize - 1 + s, acc + chunk_off(c, count),
+				chunk_len(c, count) * sizeof *acc);
+		if (ret)
+			return ret;
+
+		ret = wait_round(gsize - 1 + s);
+		if (ret)
+			return ret;
+		ret = wait_sends();
+		if (ret)
+			return ret;
+
+		memcpy(acc + off, slot(gsize - 1 + s), l * sizeof *acc);
+	}
+	return 0;
+}
+
+static int allreduce_tree(size_t count)
+{
+	void *data = acc;
+	int ret;
+
+	ret = reduce_tree(0, count);
+	if (ret)
+		return ret;
+
+	ret = bcast_tree(BCAST_BASE, &data, count * sizeof *acc);
+	if (ret)
+		return ret;
+
+	if (data != acc)
+		memcpy(acc, data, count * sizeof *acc);
+	return 0;
+}
+
+static int run_coll(int op, int alg, size_t len)
+{
+	size_t count = len / sizeof *acc;
+	void *data = acc;
+
+	switch (op) {
+	case OP_BARRIER:
+		switch (alg) {
+		case ALG_TREE:
+			return reduce_tree(0, 0) ? -FI_EOTHER :
+			       bcast_tree(BCAST_BASE, &data, 0);
+		case ALG_RD:
+			return barrier_rd();
+		default:
+			return barrier_ring();
+		}
+	case OP_BCAST:
+		return alg == ALG_TREE ? bcast_tree(0, &data, len) :
+					 bcast_ring(acc, len);
+	case OP_REDUCE:
+		return alg == ALG_TREE ? reduce_tree(0, count) :
+					 reduce_ring(count);
+	default:
+		switch (alg) {
+		case ALG_TREE:
+			return allreduce_tree(count);
+		case ALG_RD:
+			return allreduce_rd(count);
+		default:
+			return allreduce_ring(count);
+		}
+	}
+}
+
+static void init_data(size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		acc[i] = rank + 1;
+}
+
+static void check_data(int op, size_t count)
+{
+	double expect = (double) gsize * (gsize + 1) / 2;
+	size_t i;
+
+	if (op == OP_ALLREDUCE || (op == OP_REDUCE && !rank)) {
+		for (i = 0; i < count; i++) {
+			if (acc[i] != expect) {
+				errors++;
+				break;
+			}
+		}
+	}
+}
+
+static void show_perf(int op, int alg, size_t len)
+{
+	char str[32];
+	float min, max, avg;
+	int r;
+
+	min = max = avg = all_usec[0];
+	for (r = 1; r < gsize; r++) {
+		min = MIN(min, all_usec[r]);
+		max = MAX(max, all_usec[r]);
+		avg += all_usec[r];
+	}
+	avg /= gsize;
+
+	printf("%-10s%-6s%6d  ", op_str[op], alg_str[alg], gsize);
+	size_str(str, sizeof str, len);
+	printf("%-8s", str);
+	cnt_str(str, sizeof str, iterations);
+	printf("%-8s", str);
+	printf("%11.2f%11.2f%11.2f\n", avg, min, max);
+}
+
+static int run_test(int op, int alg, size_t len)
+{
+	struct timeval start, end;
+	float usec = 0;
+	size_t count = len / sizeof *acc;
+	int i, ret, active = rank < gsize;
+
+	for (i = 0; i < iterations; i++) {
+		if (op == OP_REDUCE || op == OP_ALLREDUCE)
+			init_data(count);
+
+		ret = sync_ranks();
+		if (ret)
+			return ret;
+
+		if (!active)
+			continue;
+
+		gettimeofday(&start, NULL);
+		ret = run_coll(op, alg, len);
+		if (ret)
+			return ret;
+		gettimeofday(&end, NULL);
+		usec += (end.tv_sec - start.tv_sec) * 1000000 +
+			(end.tv_usec - start.tv_usec);
+	}
+
+	if (active)
+		check_data(op, count);
+
+	usec /= iterations;
+	ret = rdv_allgather(&usec, all_usec, sizeof usec);
+	if (ret)
+		return ret;
+
+	if (!rank)
+		show_perf(op, alg, len);
+	return 0;
+}
+
+static void init_test(size_t len)
+{
+	transfer_size = len;
+	if (!custom_iterations)
+		iterations = MAX(size_to_count(len) / 100, 10);
+}
+
+static int run_op_alg(int op, int alg)
+{
+	int i, ret;
+
+	if (op == OP_BARRIER) {
+		init_test(0);
+		return run_test(op, alg, 0);
+	}
+
+	if (custom) {
+		init_test(transfer_size);
+		return run_test(op, alg, transfer_size);
+	}
+
+	for (i = 0; i < TEST_CNT; i++) {
+		if (test_size[i].option > size_option ||
+		    test_size[i].size > COLL_MAX_SIZE)
+			continue;
+		if (op != OP_BCAST && test_size[i].size % sizeof *acc)
+			continue;
+		init_test(test_size[i].size);
+		ret = run_test(op, alg, test_size[i].size);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int run_group(void)
+{
+	int op, alg, ret;
+
+	for (op = 0; op < OP_MAX; op++) {
+		if (sel_op >= 0 && op != sel_op)
+			continue;
+		for (alg = 0; alg < ALG_MAX; alg++) {
+			if ((sel_alg >= 0 && alg != sel_alg) || !op_algs[op][alg])
+				continue;
+			ret = run_op_alg(op, alg);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+static void free_ep_res(void)
+{
+	fi_close(&av->fid);
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	free(buf);
+}
+
+/*
+ * Registered region layout: accumulator, one slot per collective
+ * round, then small buffers for barrier messages and RMA notifications.
+ */
+static int alloc_ep_res(struct fi_info *fi)
+{
+	struct fi_cq_attr cq_attr;
+	struct fi_av_attr av_attr;
+	int ret;
+
+	buffer_size = custom ? transfer_size :
+		      MIN(max_test_size(size_option), COLL_MAX_SIZE);
+	buffer_size = MAX(buffer_size, sizeof(uint64_t));
+	region_size = buffer_size * (max_rounds + 1) + 2 * sizeof(uint64_t);
+	buf = calloc(1, region_size);
+	if (!buf) {
+		perror("calloc");
+		return -1;
+	}
+	acc = buf;
+	slots = (char *) buf + buffer_size;
+	sync_buf = slots + buffer_size * max_rounds;
+	note_buf = sync_buf + sizeof(uint64_t);
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_DATA;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = max_rounds << 2;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, region_size, FI_REMOTE_WRITE, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	memset(&av_attr, 0, sizeof av_attr);
+	av_attr.type = FI_AV_MAP;
+	av_attr.count = nranks;
+	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	if (ret) {
+		printf("fi_av_open %s\n", fi_strerror(-ret));
+		goto err4;
+	}
+
+	return 0;
+
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	free(buf);
+	return ret;
+}
+
+static int bind_ep_res(void)
+{
+	int ret, i;
+
+	ret = bind_fid(&ep->fid, &scq->fid, FI_SEND | FI_WRITE);
+	if (ret)
+		return ret;
+
+	ret = bind_fid(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret)
+		return ret;
+
+	ret = bind_fid(&ep->fid, &av->fid, 0);
+	if (ret)
+		return ret;
+
+	ret = fi_enable(ep);
+	if (ret) {
+		printf("fi_enable %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+
+	/* one notification receive per round that may be in flight */
+	for (i = 0; use_rma && i < max_rounds; i++) {
+		ret = post_note_recv();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int exchange_addresses(void)
+{
+	char name[MAX_ADDR_LEN], *names;
+	struct rma_peer self;
+	size_t len = sizeof name;
+	int i, ret;
+
+	memset(name, 0, sizeof name);
+	ret = fi_getname(&ep->fid, name, &len);
+	if (ret) {
+		printf("fi_getname %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	names = malloc(MAX_ADDR_LEN * nranks);
+	addrs = calloc(nranks, sizeof *addrs);
+	peers = calloc(nranks, sizeof *peers);
+	if (!names || !addrs || !peers) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	ret = rdv_allgather(name, names, MAX_ADDR_LEN);
+	if (ret)
+		goto out;
+
+	self.addr = (uint64_t) (uintptr_t) slots;
+	self.key = fi_mr_key(mr);
+	ret = rdv_allgather(&self, peers, sizeof self);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < nranks; i++) {
+		ret = fi_av_insert(av, names + i * MAX_ADDR_LEN, 1, &addrs[i], 0, NULL);
+		if (ret < 0) {
+			printf("fi_av_insert %s\n", fi_strerror(-ret));
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	free(names);
+	return ret;
+}
+
+static int init_fabric(void)
+{
+	struct fi_info *fi;
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, NULL, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_domain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err1;
+	}
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err3;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err4;
+
+	ret = exchange_addresses();
+	if (ret)
+		goto err4;
+
+	fi_freeinfo(fi);
+	return 0;
+
+err4:
+	free_ep_res();
+err3:
+	fi_close(&ep->fid);
+err2:
+	fi_close(&dom->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int run(void)
+{
+	int ret = 0;
+
+	ret = rdv_init(rdv_addr, port, &rank, &nranks);
+	if (ret)
+		return ret;
+
+	if (nranks < 2) {
+		printf("collectives need at least 2 ranks\n");
+		ret = -FI_EINVAL;
+		goto out;
+	}
+
+	/* ring allreduce uses the most rounds, tree bcast starts at BCAST_BASE */
+	max_rounds = MAX(2 * nranks, 2 * BCAST_BASE);
+	arrived = calloc(max_rounds + BCAST_BASE, sizeof *arrived);
+	round_ctx = calloc(max_rounds + BCAST_BASE, sizeof *round_ctx);
+	all_usec = calloc(nranks, sizeof *all_usec);
+	if (!arrived || !round_ctx || !all_usec) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	ret = init_fabric();
+	if (ret)
+		goto out;
+
+	if (!rank)
+		printf("%-10s%-6s%6s  %-8s%-8s%11s%11s%11s\n", "op", "alg",
+		       "ranks", "bytes", "iters", "avg usec", "min usec",
+		       "max usec");
+
+	/* grow the active group by powers of two up to all ranks */
+	for (gsize = scaling ? 2 : nranks; ; gsize = MIN(gsize << 1, nranks)) {
+		ret = run_group();
+		if (ret || gsize == nranks)
+			break;
+	}
+
+	if (errors)
+		printf("rank %d: %d result validation errors\n", rank, errors);
+
+	rdv_barrier();
+	fi_close(&ep->fid);
+	free_ep_res();
+	fi_close(&dom->fid);
+	fi_close(&fab->fid);
+out:
+	free(addrs);
+	free(peers);
+	free(arrived);
+	free(round_ctx);
+	free(all_usec);
+	rdv_close();
+	return ret ? ret : errors;
+}
+
+static int str2idx(const char **strs, int cnt, char *str)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		if (!strcasecmp(strs[i], str))
+			return i;
+	}
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:N:o:a:I:S:rx")) != -1) {
+		switch (op) {
+		case 'd':
+			rdv_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'N':
+			nranks = atoi(optarg);
+			break;
+		case 'o':
+			sel_op = str2idx(op_str, OP_MAX, optarg);
+			if (sel_op < 0)
+				goto usage;
+			break;
+		case 'a':
+			sel_alg = str2idx(alg_str, ALG_MAX, optarg);
+			if (sel_alg < 0)
+				goto usage;
+			break;
+		case 'I':
+			custom_iterations = 1;
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			if (!strncasecmp("all", optarg, 3)) {
+				size_option = SIZE_OPT_ALL;
+			} else if (strpbrk(optarg, ":,")) {
+				if (set_test_sizes(optarg))
+					exit(1);
+			} else {
+				custom = 1;
+				if (parse_transfer_size(optarg, &transfer_size))
+					exit(1);
+				/* every collective round gets its own slot */
+				if (transfer_size > COLL_MAX_SIZE) {
+					printf("transfer size limited to %d\n",
+					       COLL_MAX_SIZE);
+					exit(1);
+				}
+			}
+			break;
+		case 'r':
+			use_rma = 1;
+			break;
+		case 'x':
+			scaling = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_RDM;
+	hints.caps = FI_MSG | FI_TAGGED | FI_RMA | FI_REMOTE_CQ_DATA;
+	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
+	hints.addr_format = FI_SOCKADDR;
+
+	ret = run();
+	return ret;
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d rendezvous_address] (all ranks except rank 0)\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p rendezvous_port] (default: 9228)\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-N number_of_ranks] (rank 0 only, default: 2)\n");
+	printf("\t[-o barrier|bcast|reduce|allreduce] (default: all)\n");
+	printf("\t[-a tree|rd|ring] (default: all, rd for barrier and allreduce only)\n");
+	printf("\t[-I iterations] (default: dynamic)\n");
+	printf("\t[-S transfer_size or 'all'] (limited to 1m)\n");
+	printf("\t[-S start:end[:xN|:+N][,...]] size sweep, e.g. 64:1m:x2\n");
+	printf("\t[-r] move data with fi_writedata instead of tagged sends\n");
+	printf("\t[-x] scale the group size from 2 ranks up to all ranks\n");
+	exit(1);
+}
@@ -34,11 +34,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include <rdma/fabric.h>
+#include <rdma/fi_errno.h>
+#include <shared.h>
+
+#define WARM_CNT 100
 
 static struct fi_info hints;
 static char *node, *port;
+static int perf;
 
 /* options and matching help strings need to be kept in sync */
 
@@ -48,6 +56,7 @@ static const struct option longopts[] = {
 	{"caps", required_argument, NULL, 'c'},
 	{"mode", required_argument, NULL, 'm'},
 	{"ep_type", required_argument, NULL, 'e'},
+	{"perf", no_argument, NULL, 'P'},
 	{0,0,0,0}
 };
 
@@ -57,6 +66,7 @@ static const char *help_strings[][2] = {
 	{"CAP1|CAP2..", "\tone or more capabilities: FI_MSG|FI_RMA..."},
 	{"MOD1|MOD2..", "\tone or more modes, default all modes"},
 	{"EPTYPE", "\t\tspecify single endpoint type: FI_EP_MSG, FI_EP_DGRAM..."},
+	{"", "\t\tsummarize performance limits and time fi_getinfo"},
 	{"", ""}
 };
 
@@ -66,8 +76,9 @@ void usage()
 	const struct option *ptr = longopts;
 
 	for (; ptr->name != NULL; ++i, ptr = &longopts[i])
-		printf("  -%c, --%s=%s%s\n", ptr->val, ptr->name,
-			help_strings[i][0], help_strings[i][1]);
+		printf("  -%c, --%s%s%s%s\n", ptr->val, ptr->name,
+			ptr->has_arg ? "=" : "", help_strings[i][0],
+			help_strings[i][1]);
 }
 
 #define ORCASE(SYM) \
@@ -157,13 +168,233 @@ static int run(struct fi_info *hints, char *node, char *port)
 	return EXIT_SUCCESS;
 }
 
+static const char *ep_type_str(enum fi_ep_type type)
+{
+	switch (type) {
+	case FI_EP_MSG:
+		return "msg";
+	case FI_EP_DGRAM:
+		return "dgram";
+	case FI_EP_RDM:
+		return "rdm";
+	default:
+		return "unspec";
+	}
+}
+
+static const char *threading_str(enum fi_threading threading)
+{
+	switch (threading) {
+	case FI_THREAD_SAFE:
+		return "safe";
+	case FI_THREAD_FID:
+		return "fid";
+	case FI_THREAD_DOMAIN:
+		return "domain";
+	case FI_THREAD_COMPLETION:
+		return "comp";
+	case FI_THREAD_ENDPOINT:
+		return "ep";
+	default:
+		return "unspec";
+	}
+}
+
+static const char *progress_str(enum fi_progress progress)
+{
+	switch (progress) {
+	case FI_PROGRESS_AUTO:
+		return "auto";
+	case FI_PROGRESS_MANUAL:
+		return "manual";
+	default:
+		return "unspec";
+	}
+}
+
+static const char *mr_mode_str(enum fi_mr_mode mode)
+{
+	switch (mode) {
+	case FI_MR_BASIC:
+		return "basic";
+	case FI_MR_SCALABLE:
+		return "scalable";
+	default:
+		return "unspec";
+	}
+}
+
+static void show_size(size_t size)
+{
+	char str[32];
+
+	size_str(str, sizeof str, size);
+	printf("%9s", str);
+}
+
+/*
+ * One line per fi_info of the limits that bound performance.  tx_size
+ * is also the most operations, RMA included, a transmit context can
+ * have outstanding.
+ */
+static void show_perf_attrs(struct fi_info *info)
+{
+	struct fi_info *cur;
+
+	printf("%-10s%-16s%-7s%9s%9s%9s%9s%7s%7s%7s %-8s%-8s%-8s%s\n",
+	       "provider", "domain", "ep", "inject", "max_msg", "tx_size",
+	       "rx_size", "tx_iov", "rx_iov", "rma_iov", "thread", "ctrl",
+	       "data", "mr_mode");
+	for (cur = info; cur; cur = cur->next) {
+		printf("%-10.9s%-16.15s%-7s", cur->fabric_attr->prov_name,
+		       cur->domain_attr->name, ep_type_str(cur->ep_type));
+		show_size(cur->tx_attr->inject_size);
+		show_size(cur->ep_attr->max_msg_size);
+		printf("%9zu%9zu%7zu%7zu%7zu", cur->tx_attr->size,
+		       cur->rx_attr->size, cur->tx_attr->iov_limit,
+		       cur->rx_attr->iov_limit, cur->tx_attr->rma_iov_limit);
+		printf(" %-8s%-8s%-8s%s\n",
+		       threading_str(cur->domain_attr->threading),
+		       progress_str(cur->domain_attr->control_progress),
+		       progress_str(cur->domain_attr->data_progress),
+		       mr_mode_str(cur->domain_attr->mr_mode));
+	}
+}
+
+struct getinfo_time {
+	double cold, warm;
+	int cnt, ret;
+};
+
+static void time_getinfo(struct fi_info *hints, struct getinfo_time *t)
+{
+	struct fi_info *info, *cur;
+	double start;
+	int i;
+
+	start = get_usec();
+	t->ret = fi_getinfo(FI_VERSION(1, 0), node, port, 0, hints, &info);
+	t->cold = get_usec() - start;
+	if (t->ret)
+		return;
+
+	for (t->cnt = 0, cur = info; cur; cur = cur->next)
+		t->cnt++;
+	fi_freeinfo(info);
+
+	start = get_usec();
+	for (i = 0; i < WARM_CNT; i++) {
+		t->ret = fi_getinfo(FI_VERSION(1, 0), node, port, 0, hints, &info);
+		if (t->ret)
+			return;
+		fi_freeinfo(info);
+	}
+	t->warm = (get_usec() - start) / WARM_CNT;
+}
+
+/*
+ * Each combination is timed in a child process, so its first call pays
+ * the full provider discovery cost as a starting application would.
+ * Children must be forked before this process calls fi_getinfo, or
+ * they would inherit an initialized library.
+ */
+static int run_timed(struct fi_info *hints, struct getinfo_time *t)
+{
+	int fds[2], status;
+	pid_t pid;
+
+	if (pipe(fds)) {
+		perror("pipe");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (!pid) {
+		close(fds[0]);
+		memset(t, 0, sizeof *t);
+		time_getinfo(hints, t);
+		if (write(fds[1], t, sizeof *t) != sizeof *t)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	if (read(fds[0], t, sizeof *t) != sizeof *t) {
+		memset(t, 0, sizeof *t);
+		t->ret = -FI_EOTHER;
+	}
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	enum fi_ep_type ep_type;
+	uint64_t caps;
+} time_hints[] = {
+	{ "any", FI_EP_UNSPEC, 0 },
+	{ "msg", FI_EP_MSG, FI_MSG },
+	{ "msg+rma", FI_EP_MSG, FI_MSG | FI_RMA },
+	{ "rdm+tagged", FI_EP_RDM, FI_TAGGED },
+	{ "rdm+atomics", FI_EP_RDM, FI_ATOMICS },
+	{ "dgram", FI_EP_DGRAM, FI_MSG },
+};
+
+#define TIME_CNT (sizeof time_hints / sizeof time_hints[0])
+
+static int run_perf(struct fi_info *hints, char *node, char *port)
+{
+	struct getinfo_time t[TIME_CNT + 1];
+	struct fi_info *info, cur_hints;
+	int i, ret;
+
+	/* t[0] is the given hints, t[i + 1] is time_hints[i] */
+	for (i = 0; i <= (int) TIME_CNT; i++) {
+		cur_hints = *hints;
+		if (i) {
+			cur_hints.ep_type = time_hints[i - 1].ep_type;
+			cur_hints.caps = time_hints[i - 1].caps;
+		}
+		ret = run_timed(&cur_hints, &t[i]);
+		if (ret)
+			return ret;
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), node, port, 0, hints, &info);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+	show_perf_attrs(info);
+	fi_freeinfo(info);
+
+	printf("\nfi_getinfo usec (warm averaged over %d calls)\n", WARM_CNT);
+	printf("%-14s%12s%12s%9s\n", "hints", "cold", "warm", "results");
+	for (i = 0; i <= (int) TIME_CNT; i++) {
+		printf("%-14s", i ? time_hints[i - 1].name : "given");
+		if (t[i].ret)
+			printf("%12.1f%12s  %s\n", t[i].cold, "-", fi_strerror(-t[i].ret));
+		else
+			printf("%12.1f%12.1f%9d\n", t[i].cold, t[i].warm, t[i].cnt);
+	}
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
 	int op;
 
 	hints.mode = ~0;
 
-	while ((op = getopt_long(argc, argv, "n:p:c:m:e:h", longopts, NULL)) != -1) {
+	while ((op = getopt_long(argc, argv, "n:p:c:m:e:Ph", longopts, NULL)) != -1) {
 		switch (op) {
 		case 'n':
 			node = optarg;
@@ -180,6 +411,9 @@ int main(int argc, char **argv)
 		case 'e':
 			hints.ep_type = str2ep_type(optarg);
 			break;
+		case 'P':
+			perf = 1;
+			break;
 		case 'h':
 		default:
 			printf("usage: %s\n", argv[0]);
@@ -188,5 +422,5 @@ int main(int argc, char **argv)
 		}
 	}
 
-	return run(&hints, node, port);
+	return perf ? run_perf(&hints, node, port) : run(&hints, node, port);
 }
@@ -0,0 +1,642 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * LogGP parameters from fi_send and fi_recv.  For each size the client
+ * runs a pingpong, timing its own fi_send calls (send overhead o_s) and
+ * the reaping and reposting of each arrived receive (receive overhead
+ * o_r), and then streams back to back sends to get the time per
+ * message.
+ *
+ * The parameters are fitted from the sweep: o_s and o_r are taken at
+ * the smallest size, L is the small message half round trip less both
+ * overheads, g is the small message streaming time per message, and G
+ * is the slope of the streaming time per message over the larger half
+ * of the sizes.  Both sides must be given the same -S and -I.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_cm.h>
+#include <shared.h>
+
+#define MAX_ITERATIONS 10000
+
+static int iterations;
+static int window = 64;
+static double *rtt, *os_sample, *or_sample;
+static double *half_rtt, *send_o, *recv_o, *gap;
+static void *buf;
+static size_t buffer_size;
+static char *prov_name;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *dst_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_pep *pep;
+static struct fid_domain *dom;
+static struct fid_ep *ep;
+static struct fid_eq *cmeq;
+static struct fid_cq *rcq, *scq;
+static struct fid_mr *mr;
+static struct msg_window win;
+
+static int probe_pingpong(int i)
+{
+	double t0;
+	int ret, j, size = test_size[i].size, cnt = probe_count(size, iterations);
+
+	for (j = 0; j < cnt; j++) {
+		t0 = get_usec();
+		if (dst_addr) {
+			ret = win_post_send(&win, size, &os_sample[j]);
+			if (!ret)
+				ret = win_wait_recv(&win, &or_sample[j]);
+		} else {
+			ret = win_wait_recv(&win, NULL);
+			if (!ret)
+				ret = win_post_send(&win, size, NULL);
+		}
+		if (ret)
+			return ret;
+		rtt[j] = get_usec() - t0;
+	}
+
+	half_rtt[i] = median(rtt, cnt) / 2;
+	send_o[i] = median(os_sample, cnt);
+	recv_o[i] = median(or_sample, cnt);
+	return 0;
+}
+
+static int probe_stream(int i)
+{
+	double usec;
+	int ret, size = test_size[i].size, cnt = probe_count(size, iterations);
+
+	ret = win_stream(&win, dst_addr != NULL, size, cnt, &usec);
+	if (!ret)
+		gap[i] = usec / cnt;
+	return ret;
+}
+
+/* Least squares slope of the gap per message over sizes first to cnt - 1. */
+static double fit_slope(int first, int cnt)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, n = cnt - first, x;
+	int i;
+
+	if (n < 2)
+		return 0;
+
+	for (i = first; i < cnt; i++) {
+		x = test_size[i].size;
+		sx += x;
+		sy += gap[i];
+		sxx += x * x;
+		sxy += x * gap[i];
+	}
+	return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+static void show_params(int cnt)
+{
+	double L, G;
+
+	L = MAX(0, half_rtt[0] - send_o[0] - recv_o[0]);
+	G = fit_slope(cnt / 2, cnt);
+
+	printf("\nLogGP for %s (usec):\n", prov_name);
+	printf("  L   %10.3f\n", L);
+	printf("  o_s %10.3f\n", send_o[0]);
+	printf("  o_r %10.3f\n", recv_o[0]);
+	printf("  g   %10.3f\n", gap[0]);
+	if (G > 0)
+		printf("  G   %10.6f (%.2f MB/sec)\n", G, 1 / G);
+	else
+		printf("  G   %10s (needs more sizes)\n", "-");
+}
+
+static int run_sweep(void)
+{
+	char str[32];
+	int ret, i;
+
+	if (dst_addr)
+		printf("%-10s%12s%12s%12s%12s\n", "bytes", "half_rtt", "o_s",
+		       "o_r", "gap/msg");
+
+	for (i = 0; i < TEST_CNT; i++) {
+		ret = win_sync(&win, dst_addr != NULL);
+		if (!ret)
+			ret = probe_pingpong(i);
+		if (!ret)
+			ret = win_sync(&win, dst_addr != NULL);
+		if (!ret)
+			ret = probe_stream(i);
+		if (ret)
+			return ret;
+
+		if (!dst_addr)
+			continue;
+		size_str(str, sizeof str, test_size[i].size);
+		printf("%-10s%12.3f%12.3f%12.3f%12.3f\n", str, half_rtt[i],
+		       send_o[i], recv_o[i], gap[i]);
+	}
+
+	if (dst_addr)
+		show_params(TEST_CNT);
+	return win_wait_sends(&win);
+}
+
+static void free_lres(void)
+{
+	fi_close(&cmeq->fid);
+}
+
+static int alloc_cm_res(void)
+{
+	struct fi_eq_attr cm_attr;
+	int ret;
+
+	memset(&cm_attr, 0, sizeof cm_attr);
+	cm_attr.wait_obj = FI_WAIT_FD;
+	ret = fi_eq_open(fab, &cm_attr, &cmeq, NULL);
+	if (ret)
+		printf("fi_eq_open cm %s\n", fi_strerror(-ret));
+
+	return ret;
+}
+
+static void free_ep_res(void)
+{
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	free(gap);
+	free(recv_o);
+	free(send_o);
+	free(half_rtt);
+	free(or_sample);
+	free(os_sample);
+	free(rtt);
+	free(prov_name);
+	free(buf);
+}
+
+static int alloc_ep_res(struct fi_info *fi)
+{
+	struct fi_cq_attr cq_attr;
+	int ret, cnt = iterations ? iterations : MAX_ITERATIONS;
+
+	buffer_size = MAX(max_test_size(0), WIN_SYNC_SIZE);
+	buf = malloc(buffer_size);
+	prov_name = strdup(fi->fabric_attr->prov_name);
+	rtt = calloc(cnt, sizeof *rtt);
+	os_sample = calloc(cnt, sizeof *os_sample);
+	or_sample = calloc(cnt, sizeof *or_sample);
+	half_rtt = calloc(TEST_CNT, sizeof *half_rtt);
+	send_o = calloc(TEST_CNT, sizeof *send_o);
+	recv_o = calloc(TEST_CNT, sizeof *recv_o);
+	gap = calloc(TEST_CNT, sizeof *gap);
+	if (!buf || !prov_name || !rtt || !os_sample || !or_sample ||
+	    !half_rtt || !send_o || !recv_o || !gap) {
+		perror("malloc");
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = window << 1;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	if (!cmeq) {
+		ret = alloc_cm_res();
+		if (ret)
+			goto err4;
+	}
+
+	return 0;
+
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	free(gap);
+	free(recv_o);
+	free(send_o);
+	free(half_rtt);
+	free(or_sample);
+	free(os_sample);
+	free(rtt);
+	free(prov_name);
+	free(buf);
+	return ret;
+}
+
+static int bind_ep_res(void)
+{
+	int ret;
+
+	ret = fi_bind(&ep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_enable(ep);
+	if (ret)
+		return ret;
+
+	win.ep = ep;
+	win.scq = scq;
+	win.rcq = rcq;
+	win.mr = mr;
+	win.buf = buf;
+	win.size = buffer_size;
+	win.window = window;
+	return win_init(&win);
+}
+
+static int server_listen(void)
+{
+	struct fi_info *fi;
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_pendpoint(fab, fi, &pep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_cm_res();
+	if (ret)
+		goto err2;
+
+	ret = fi_bind(&pep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = fi_listen(pep);
+	if (ret) {
+		printf("fi_listen %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	fi_freeinfo(fi);
+	return 0;
+err3:
+	free_lres();
+err2:
+	fi_close(&pep->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int server_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *info = NULL;
+	ssize_t rd;
+	int ret;
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		return (int) rd;
+	}
+
+	if (event != FI_CONNREQ) {
+		printf("Unexpected CM event %d\n", event);
+		ret = -FI_EOTHER;
+		goto err1;
+	}
+
+	info = entry.info;
+	ret = fi_domain(fab, info, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_endpoint(dom, info, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint for req %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_ep_res(info);
+	if (ret)
+		 goto err2;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err3;
+
+	ret = fi_accept(ep, NULL, 0);
+	if (ret) {
+		printf("fi_accept %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		goto err3;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err3;
+	}
+
+	fi_freeinfo(info);
+	return 0;
+
+err3:
+	free_ep_res();
+err2:
+	fi_close(&ep->fid);
+err1:
+	fi_reject(pep, info->connreq, NULL, 0);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int client_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *fi;
+	ssize_t rd;
+	int ret;
+
+	if (src_addr) {
+		ret = getaddr(src_addr, NULL, (struct sockaddr **) &hints.src_addr,
+			      (socklen_t *) &hints.src_addrlen);
+		if (ret)
+			printf("source address error %s\n", gai_strerror(ret));
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err2;
+	}
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err4;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err5;
+
+	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
+	if (ret) {
+		printf("fi_connect %s\n", fi_strerror(-ret));
+		goto err5;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_condread %zd %s\n", rd, fi_strerror((int) -rd));
+		ret = (int) rd;
+		goto err5;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err5;
+	}
+
+	if (hints.src_addr)
+		free(hints.src_addr);
+	fi_freeinfo(fi);
+	return 0;
+
+err5:
+	free_ep_res();
+err4:
+	fi_close(&ep->fid);
+err3:
+	fi_close(&dom->fid);
+err2:
+	fi_close(&fab->fid);
+err1:
+	fi_freeinfo(fi);
+err0:
+	if (hints.src_addr)
+		free(hints.src_addr);
+	return ret;
+}
+
+static int run(void)
+{
+	int ret;
+
+	if (!dst_addr) {
+		ret = server_listen();
+		if (ret)
+			return ret;
+	}
+
+	ret = dst_addr ? client_connect() : server_connect();
+	if (ret)
+		return ret;
+
+	ret = run_sweep();
+
+	fi_shutdown(ep, 0);
+	fi_close(&ep->fid);
+	free_ep_res();
+	if (!dst_addr)
+		free_lres();
+	fi_close(&dom->fid);
+	fi_close(&fab->fid);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	char *sizes = "1:4m:x4";
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:I:S:w:")) != -1) {
+		switch (op) {
+		case 'd':
+			dst_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'I':
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			sizes = optarg;
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (iterations < 0 || window < 1) {
+		printf("iterations and window must be positive\n");
+		goto usage;
+	}
+
+	ret = set_test_sizes(sizes);
+	if (ret)
+		return ret;
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_MSG;
+	hints.caps = FI_MSG;
+	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
+	hints.addr_format = FI_SOCKADDR;
+
+	return run();
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d destination_address]\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p port_number]\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-I iterations per size (default: by size)]\n");
+	printf("\t[-S size sweep, smallest first (default 1:4m:x4)]\n");
+	printf("\t[-w max outstanding sends (default 64)]\n");
+	exit(1);
+}
@@ -55,8 +55,12 @@
 #include <rdma/fi_cm.h>
 #include <shared.h>
 
+#define SOAK_SAMPLES (1 << 20)
+#define MAX_PROVIDERS 16
+#define PROV_SKIP 1
+
 static int custom;
-static int size_option;
+static int size_option = SIZE_OPT_DEFAULT;
 static int iterations = 1000;
 static int transfer_size = 1000;
 static int max_credits = 128;
@@ -65,6 +69,21 @@ static char test_name[10] = "custom";
 static struct timeval start, end;
 static void *buf;
 static size_t buffer_size;
+static int verify;
+static int soak_time;
+static int soak_interval = 1;
+static uint64_t tx_seq, rx_seq;
+static long verify_errors;
+static float verify_usec;
+static int all_providers;
+static int prov_index, prov_cnt, more_providers;
+static char *prov_name[MAX_PROVIDERS];
+static float *prov_usec[MAX_PROVIDERS];
+static int *prov_size;
+static int prov_skipped[MAX_PROVIDERS];
+static int result_cnt, row_cnt;
+static enum fi_cq_format cq_format = FI_CQ_FORMAT_CONTEXT;
+static int cq_mode;
 
 static struct fi_info hints;
 static struct fi_domain_attr domain_hints;
@@ -80,6 +99,14 @@ static struct fid_eq *cmeq;
 static struct fid_cq *rcq, *scq;
 static struct fid_mr *mr;
 
+static const struct option longopts[] = {
+	{"time", required_argument, NULL, 'T'},
+	{"interval", required_argument, NULL, 'i'},
+	{"all-providers", no_argument, NULL, 'A'},
+	{"cq-format", required_argument, NULL, 'F'},
+	{"cq", required_argument, NULL, 'q'},
+	{0, 0, 0, 0}
+};
 
 static void show_perf(void)
 {
@@ -100,9 +127,47 @@ static void show_perf(void)
 	printf("%-8s", str);
 	size_str(str, sizeof str, bytes);
 	printf("%-8s", str);
-	printf("%8.2fs%10.2f%11.2f\n",
+	printf("%8.2fs%10.2f%11.2f",
 		usec / 1000000., (bytes * 8) / (1000. * usec),
 		(usec / iterations) / 2);
+	if (verify)
+		printf("%8ld%7.1f%%", verify_errors, 100. * verify_usec / usec);
+	if (cq_mode) {
+		long long polls, empty;
+
+		cq_poll_stats(&polls, &empty);
+		printf("%10.3f%11.2f%8.1f%%", iterations * 2 / usec,
+		       (double) polls / (iterations * 2),
+		       polls ? 100. * empty / polls : 0);
+	}
+	printf("\n");
+}
+
+/*
+ * Every test message carries a pattern seeded by its sequence number in
+ * its direction.  Time spent filling and checking is reported as a share
+ * of the test time.  A received message is checked before this side
+ * replies, so the peer cannot overwrite it first.
+ */
+static void verify_fill(int size)
+{
+	struct timeval t0, t1;
+
+	gettimeofday(&t0, NULL);
+	fill_pattern(buf, size, tx_seq++);
+	gettimeofday(&t1, NULL);
+	verify_usec += (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_usec - t0.tv_usec);
+}
+
+static void verify_check(int size)
+{
+	struct timeval t0, t1;
+
+	gettimeofday(&t0, NULL);
+	if (check_pattern(buf, size, rx_seq++))
+		verify_errors++;
+	gettimeofday(&t1, NULL);
+	verify_usec += (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_usec - t0.tv_usec);
 }
 
 static void init_test(int size)
@@ -117,22 +182,21 @@ static void init_test(int size)
 
 static int send_xfer(int size)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
 	while (!credits) {
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
+		ret = cq_read_tx(scq);
+		if (ret > 0)
 			goto post;
-		} else if (ret < 0) {
-			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+		else if (ret < 0)
 			return ret;
-		}
 	}
 
 	credits--;
 post:
-	ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), NULL);
+	do {
+		ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), NULL);
+	} while (post_again(&ret, scq));
 	if (ret)
 		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
 
@@ -141,18 +205,15 @@ post:
 
 static int recv_xfer(int size)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, 1);
-		if (ret < 0) {
-			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
-			return ret;
-		}
-	} while (!ret);
+	ret = cq_wait_rx(rcq, 1);
+	if (ret)
+		return ret;
 
-	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	do {
+		ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	} while (post_again(&ret, rcq));
 	if (ret)
 		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
 
@@ -163,7 +224,7 @@ static int sync_test(void)
 {
 	int ret;
 
-	ret = wait_for_completion(scq, max_credits - credits);
+	ret = cq_wait_tx(scq, max_credits - credits);
 	if (ret) {
 		return ret;
 	}
@@ -177,6 +238,167 @@ static int sync_test(void)
 	return dst_addr ? recv_xfer(16) : send_xfer(16);
 }
 
+static int ping_pong(void)
+{
+	int ret;
+
+	if (dst_addr) {
+		if (verify)
+			verify_fill(transfer_size);
+		ret = send_xfer(transfer_size);
+		if (ret)
+			return ret;
+
+		ret = recv_xfer(transfer_size);
+		if (!ret && verify)
+			verify_check(transfer_size);
+	} else {
+		ret = recv_xfer(transfer_size);
+		if (ret)
+			return ret;
+
+		if (verify) {
+			verify_check(transfer_size);
+			verify_fill(transfer_size);
+		}
+		ret = send_xfer(transfer_size);
+	}
+	return ret;
+}
+
+/*
+ * With --all-providers the same sweep runs over each fi_info matching
+ * the hints in turn, and the client keeps every result for a side by
+ * side comparison.
+ */
+static void record_perf(void)
+{
+	float usec;
+
+	if (!dst_addr || result_cnt >= TEST_CNT)
+		return;
+
+	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+	prov_size[result_cnt] = transfer_size;
+	prov_usec[prov_index][result_cnt++] = (usec / iterations) / 2;
+	row_cnt = MAX(row_cnt, result_cnt);
+}
+
+static void show_comparison(void)
+{
+	char str[32];
+	int i, k;
+
+	printf("\nusec/xfer by provider\n%-10s", "bytes");
+	for (k = 0; k < prov_cnt; k++)
+		printf("%12.11s", prov_name[k]);
+	printf("\n");
+
+	for (i = 0; i < row_cnt; i++) {
+		size_str(str, sizeof str, prov_size[i]);
+		printf("%-10s", str);
+		for (k = 0; k < prov_cnt; k++) {
+			if (prov_skipped[k])
+				printf("%12s", "-");
+			else
+				printf("%12.2f", prov_usec[k][i]);
+		}
+		printf("\n");
+	}
+}
+
+struct prov_sel {
+	char prov[32];
+	char domain[64];
+};
+
+/*
+ * The client's fi_info list sets the order of the run.  The server's
+ * list may differ in order and length, so the client names the
+ * provider and domain it picked over the rendezvous socket and the
+ * server looks for the same pair in its own list.
+ */
+static struct fi_info *select_info(struct fi_info *fi)
+{
+	int i;
+
+	for (i = 0; fi && i < prov_index; i++)
+		fi = fi->next;
+	return fi;
+}
+
+static int send_selection(struct fi_info *fi)
+{
+	struct prov_sel sel, all[2];
+
+	memset(&sel, 0, sizeof sel);
+	strncpy(sel.prov, fi->fabric_attr->prov_name, sizeof sel.prov - 1);
+	strncpy(sel.domain, fi->domain_attr->name, sizeof sel.domain - 1);
+	return rdv_allgather(&sel, all, sizeof sel) ? -FI_EOTHER : 0;
+}
+
+static int recv_selection(struct prov_sel *sel)
+{
+	struct prov_sel all[2];
+
+	memset(sel, 0, sizeof *sel);
+	if (rdv_allgather(sel, all, sizeof *sel))
+		return -FI_EOTHER;
+	*sel = all[1];
+	return 0;
+}
+
+static struct fi_info *match_selection(struct fi_info *fi, struct prov_sel *sel)
+{
+	for (; fi; fi = fi->next) {
+		if (!strncmp(fi->fabric_attr->prov_name, sel->prov, sizeof sel->prov - 1) &&
+		    !strncmp(fi->domain_attr->name, sel->domain, sizeof sel->domain - 1))
+			return fi;
+	}
+	printf("no provider %s, domain %s to listen on\n", sel->prov, sel->domain);
+	return NULL;
+}
+
+/* The server reports whether it is listening, the client learns that. */
+static int sync_listen(int *listening)
+{
+	int all[2];
+
+	if (rdv_allgather(listening, all, sizeof *listening))
+		return -FI_EOTHER;
+	*listening = all[0];
+	return 0;
+}
+
+/*
+ * A provider the server cannot listen on is left out of the comparison.
+ * With no connection to carry the client's decision to go on, it
+ * travels over the rendezvous socket.
+ */
+static int skip_provider(void)
+{
+	int all[2];
+
+	if (dst_addr) {
+		prov_skipped[prov_index] = 1;
+		more_providers = prov_index + 1 < prov_cnt;
+	}
+	if (rdv_allgather(&more_providers, all, sizeof more_providers))
+		return -FI_EOTHER;
+	more_providers = all[1];
+	return 0;
+}
+
+static char *prov_port(void)
+{
+	static char str[16];
+
+	if (!all_providers)
+		return port;
+	snprintf(str, sizeof str, "%d", atoi(port) + prov_index);
+	return str;
+}
+
 static int run_test(void)
 {
 	int ret, i;
@@ -185,29 +407,114 @@ static int run_test(void)
 	if (ret)
 		goto out;
 
+	verify_errors = 0;
+	verify_usec = 0;
+	if (cq_mode)
+		cq_poll_reset();
 	gettimeofday(&start, NULL);
 	for (i = 0; i < iterations; i++) {
-		ret = dst_addr ? send_xfer(transfer_size) :
-				 recv_xfer(transfer_size);
-		if (ret)
-			goto out;
-
-		ret = dst_addr ? recv_xfer(transfer_size) :
-				 send_xfer(transfer_size);
+		ret = ping_pong();
 		if (ret)
 			goto out;
 	}
 	gettimeofday(&end, NULL);
 	show_perf();
+	if (all_providers)
+		record_perf();
 	ret = 0;
 
 out:
 	return ret;
 }
 
+/*
+ * The client decides whether a soak round or another provider follows
+ * and tells the server in this exchange.
+ */
+static int sync_more(int *more)
+{
+	int ret;
+
+	ret = cq_wait_tx(scq, max_credits - credits);
+	if (ret)
+		return ret;
+	credits = max_credits;
+
+	if (dst_addr) {
+		*(int *) buf = *more;
+		ret = send_xfer(16);
+		if (!ret)
+			ret = recv_xfer(16);
+	} else {
+		ret = recv_xfer(16);
+		if (ret)
+			return ret;
+		*more = *(int *) buf;
+		ret = send_xfer(16);
+	}
+	return ret;
+}
+
+static int run_soak(void)
+{
+	struct soak_stats st;
+	double test_start, deadline, next, now, t0 = 0;
+	int ret, i, more = 1;
+
+	if (dst_addr) {
+		ret = soak_init(&st, SOAK_SAMPLES);
+		if (ret)
+			return ret;
+	}
+
+	verify_errors = 0;
+	verify_usec = 0;
+	test_start = get_usec();
+	deadline = test_start + soak_time * 1000000.;
+	next = test_start + soak_interval * 1000000.;
+	while (more) {
+		for (i = 0; i < iterations; i++) {
+			if (dst_addr)
+				t0 = get_usec();
+			ret = ping_pong();
+			if (ret)
+				goto out;
+			if (!dst_addr)
+				continue;
+
+			now = get_usec();
+			soak_add(&st, (now - t0) / 2, transfer_size * 2);
+			if (now >= next) {
+				soak_report(&st, test_start);
+				while (next <= now)
+					next += soak_interval * 1000000.;
+			}
+		}
+
+		if (dst_addr)
+			more = get_usec() < deadline;
+		ret = sync_more(&more);
+		if (ret)
+			goto out;
+	}
+
+	if (dst_addr) {
+		if (st.cnt)
+			soak_report(&st, test_start);
+		if (verify)
+			printf("verify: %ld errors, %.1f%% of run time\n", verify_errors,
+			       100. * verify_usec / (get_usec() - test_start));
+	}
+out:
+	if (dst_addr)
+		soak_free(&st);
+	return ret;
+}
+
 static void free_lres(void)
 {
 	fi_close(&cmeq->fid);
+	cmeq = NULL;
 }
 
 static int alloc_cm_res(void)
@@ -227,7 +534,8 @@ static int alloc_cm_res(void)
 static void free_ep_res(void)
 {
 	fi_close(&mr->fid);
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 	fi_close(&scq->fid);
 	free(buf);
 }
@@ -237,7 +545,7 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_cq_attr cq_attr;
 	int ret;
 
-	buffer_size = !custom ? test_size[TEST_CNT - 1].size : transfer_size;
+	buffer_size = !custom ? max_test_size(size_option) : transfer_size;
 	buf = malloc(buffer_size);
 	if (!buf) {
 		perror("malloc");
@@ -245,19 +553,25 @@ static int alloc_ep_res(struct fi_info *fi)
 	}
 
 	memset(&cq_attr, 0, sizeof cq_attr);
-	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.format = cq_format;
 	cq_attr.wait_obj = FI_WAIT_NONE;
 	cq_attr.size = max_credits << 1;
+	if (cq_mode == CQ_SHARED)
+		cq_attr.size += max_credits;
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
 	if (ret) {
 		printf("fi_eq_open send comp %s\n", fi_strerror(-ret));
 		goto err1;
 	}
 
-	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
-	if (ret) {
-		printf("fi_eq_open recv comp %s\n", fi_strerror(-ret));
-		goto err2;
+	if (cq_mode == CQ_SHARED) {
+		rcq = scq;
+	} else {
+		ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+		if (ret) {
+			printf("fi_eq_open recv comp %s\n", fi_strerror(-ret));
+			goto err2;
+		}
 	}
 
 	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
@@ -277,7 +591,8 @@ static int alloc_ep_res(struct fi_info *fi)
 err4:
 	fi_close(&mr->fid);
 err3:
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 err2:
 	fi_close(&scq->fid);
 err1:
@@ -295,16 +610,19 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
-	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND);
+	ret = fi_bind(&ep->fid, &scq->fid,
+		      rcq == scq ? FI_SEND | FI_RECV : FI_SEND);
 	if (ret) {
 		printf("fi_bind %s\n", fi_strerror(-ret));
 		return ret;
 	}
 
-	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
-	if (ret) {
-		printf("fi_bind %s\n", fi_strerror(-ret));
-		return ret;
+	if (rcq != scq) {
+		ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+		if (ret) {
+			printf("fi_bind %s\n", fi_strerror(-ret));
+			return ret;
+		}
 	}
 
 	ret = fi_enable(ep);
@@ -320,15 +638,29 @@ static int bind_ep_res(void)
 
 static int server_listen(void)
 {
-	struct fi_info *fi;
+	struct fi_info *list, *fi;
+	struct prov_sel sel;
 	int ret;
 
-	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, FI_SOURCE, &hints, &fi);
+	if (all_providers) {
+		ret = recv_selection(&sel);
+		if (ret)
+			return ret;
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, prov_port(), FI_SOURCE,
+			 &hints, &list);
 	if (ret) {
 		printf("fi_getinfo %s\n", strerror(-ret));
 		return ret;
 	}
 
+	fi = all_providers ? match_selection(list, &sel) : list;
+	if (!fi) {
+		ret = -FI_ENODATA;
+		goto err0;
+	}
+
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
 	if (ret) {
 		printf("fi_fabric %s\n", fi_strerror(-ret));
@@ -357,7 +689,7 @@ static int server_listen(void)
 		goto err3;
 	}
 
-	fi_freeinfo(fi);
+	fi_freeinfo(list);
 	return 0;
 err3:
 	free_lres();
@@ -366,7 +698,7 @@ err2:
 err1:
 	fi_close(&fab->fid);
 err0:
-	fi_freeinfo(fi);
+	fi_freeinfo(list);
 	return ret;
 }
 
@@ -447,9 +779,9 @@ static int client_connect(void)
 {
 	struct fi_eq_cm_entry entry;
 	uint32_t event;
-	struct fi_info *fi;
+	struct fi_info *list, *fi;
 	ssize_t rd;
-	int ret;
+	int ret, listening;
 
 	if (src_addr) {
 		ret = getaddr(src_addr, NULL, (struct sockaddr **) &hints.src_addr,
@@ -458,12 +790,36 @@ static int client_connect(void)
 			printf("source address error %s\n", gai_strerror(ret));
 	}
 
-	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, prov_port(), 0, &hints, &list);
 	if (ret) {
 		printf("fi_getinfo %s\n", strerror(-ret));
 		goto err0;
 	}
 
+	for (prov_cnt = 0, fi = list; fi; fi = fi->next)
+		prov_cnt++;
+	prov_cnt = MIN(prov_cnt, MAX_PROVIDERS);
+	fi = select_info(list);
+	if (all_providers) {
+		if (!prov_name[prov_index])
+			prov_name[prov_index] = strdup(fi->fabric_attr->prov_name);
+		printf("provider %d of %d: %s, domain %s\n", prov_index + 1,
+		       prov_cnt, fi->fabric_attr->prov_name, fi->domain_attr->name);
+
+		listening = 0;
+		ret = send_selection(fi);
+		if (!ret)
+			ret = sync_listen(&listening);
+		if (ret)
+			goto err1;
+		if (!listening) {
+			printf("server cannot listen on %s, skipping it\n",
+			       fi->fabric_attr->prov_name);
+			ret = PROV_SKIP;
+			goto err1;
+		}
+	}
+
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
 	if (ret) {
 		printf("fi_fabric %s\n", fi_strerror(-ret));
@@ -500,19 +856,20 @@ static int client_connect(void)
 	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
 	if (rd != sizeof entry) {
 		printf("fi_eq_condread %zd %s\n", rd, fi_strerror((int) -rd));
-		return (int) rd;
+		ret = (int) rd;
+		goto err5;
 	}
 
 	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
 		printf("Unexpected CM event %d fid %p (ep %p)\n",
 			event, entry.fid, ep);
 		ret = -FI_EOTHER;
-		goto err1;
+		goto err5;
 	}
 
 	if (hints.src_addr)
 		free(hints.src_addr);
-	fi_freeinfo(fi);
+	fi_freeinfo(list);
 	return 0;
 
 err5:
@@ -524,7 +881,7 @@ err3:
 err2:
 	fi_close(&fab->fid);
 err1:
-	fi_freeinfo(fi);
+	fi_freeinfo(list);
 err0:
 	if (hints.src_addr)
 		free(hints.src_addr);
@@ -533,23 +890,46 @@ err0:
 
 static int run(void)
 {
-	int i, ret = 0;
+	int i, listening, ret = 0;
 
 	if (!dst_addr) {
 		ret = server_listen();
+		if (all_providers) {
+			listening = !ret;
+			if (sync_listen(&listening))
+				return -FI_EOTHER;
+			if (!listening)
+				return PROV_SKIP;
+		}
 		if (ret)
 			return ret;
 	}
 
-	printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s\n",
-	       "name", "bytes", "xfers", "iters", "total", "time", "Gb/sec", "usec/xfer");
-
 	ret = dst_addr ? client_connect() : server_connect();
 	if (ret) {
 		return ret;
 	}
 
-	if (!custom) {
+	if (cq_format != FI_CQ_FORMAT_CONTEXT)
+		printf("cq format: %s (%zu byte entries)\n",
+		       cq_format_str(cq_format), cq_entry_size(cq_format));
+
+	if (soak_time) {
+		soak_header();
+	} else {
+		printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s",
+		       "name", "bytes", "xfers", "iters", "total", "time",
+		       "Gb/sec", "usec/xfer");
+		if (verify)
+			printf("%8s%8s", "errors", "verify");
+		if (cq_mode)
+			printf("%10s%11s%9s", "Mmsg/s", "polls/msg", "empty");
+		printf("\n");
+	}
+
+	if (soak_time) {
+		ret = run_soak();
+	} else if (!custom) {
 		for (i = 0; i < TEST_CNT; i++) {
 			if (test_size[i].option > size_option)
 				continue;
@@ -560,27 +940,87 @@ static int run(void)
 		ret = run_test();
 	}
 
-	ret = wait_for_completion(scq, max_credits - credits);
+	if (post_eagain())
+		printf("%ld posts retried after -FI_EAGAIN\n", post_eagain());
+
+	ret = cq_wait_tx(scq, max_credits - credits);
 	if (ret) {
 		return ret;
 	}
 	credits = max_credits;
 
+	if (all_providers) {
+		more_providers = prov_index + 1 < prov_cnt;
+		ret = sync_more(&more_providers);
+		if (ret)
+			return ret;
+		ret = cq_wait_tx(scq, max_credits - credits);
+		if (ret)
+			return ret;
+		credits = max_credits;
+	}
+
 	fi_shutdown(ep, 0);
 	fi_close(&ep->fid);
 	free_ep_res();
-	if (!dst_addr)
+	if (!dst_addr || all_providers)
 		free_lres();
+	if (!dst_addr && all_providers)
+		fi_close(&pep->fid);
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
 	return ret;
 }
 
+/*
+ * The provider selection travels over a rendezvous socket, on the port
+ * after the last one a provider may listen on.
+ */
+static int run_all(void)
+{
+	char rdv_port[16];
+	int ret, k, rank, nranks = 2;
+
+	prov_size = calloc(TEST_CNT, sizeof *prov_size);
+	for (k = 0; k < MAX_PROVIDERS; k++) {
+		prov_usec[k] = calloc(TEST_CNT, sizeof *prov_usec[k]);
+		if (!prov_usec[k] || !prov_size) {
+			perror("calloc");
+			return -FI_ENOMEM;
+		}
+	}
+
+	snprintf(rdv_port, sizeof rdv_port, "%d", atoi(port) + MAX_PROVIDERS);
+	ret = rdv_init(dst_addr, rdv_port, &rank, &nranks);
+	if (ret)
+		goto out;
+
+	for (prov_index = 0; ; prov_index++) {
+		result_cnt = 0;
+		ret = run();
+		if (ret == PROV_SKIP)
+			ret = skip_provider();
+		if (ret || !more_providers)
+			break;
+	}
+	rdv_close();
+
+	if (!ret && dst_addr)
+		show_comparison();
+out:
+	for (k = 0; k < MAX_PROVIDERS; k++) {
+		free(prov_usec[k]);
+		free(prov_name[k]);
+	}
+	free(prov_size);
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	int op, ret;
 
-	while ((op = getopt(argc, argv, "d:n:p:s:C:I:S:")) != -1) {
+	while ((op = getopt_long(argc, argv, "d:n:p:s:C:F:I:S:Vq:", longopts, NULL)) != -1) {
 		switch (op) {
 		case 'd':
 			dst_addr = optarg;
@@ -600,10 +1040,39 @@ int main(int argc, char **argv)
 			break;
 		case 'S':
 			if (!strncasecmp("all", optarg, 3)) {
-				size_option = 1;
+				size_option = SIZE_OPT_ALL;
+			} else if (strpbrk(optarg, ":,")) {
+				if (set_test_sizes(optarg))
+					exit(1);
 			} else {
 				custom = 1;
-				transfer_size = atoi(optarg);
+				if (parse_transfer_size(optarg, &transfer_size))
+					exit(1);
+			}
+			break;
+		case 'V':
+			verify = 1;
+			break;
+		case 'F':
+			if (str_to_cq_format(optarg, &cq_format))
+				exit(1);
+			break;
+		case 'q':
+			cq_mode = str_to_cq_mode(optarg);
+			if (cq_mode < 0)
+				exit(1);
+			break;
+		case 'A':
+			all_providers = 1;
+			break;
+		case 'T':
+			soak_time = atoi(optarg);
+			break;
+		case 'i':
+			soak_interval = atoi(optarg);
+			if (soak_interval < 1) {
+				printf("interval must be at least 1 second\n");
+				exit(1);
 			}
 			break;
 		default:
@@ -614,6 +1083,14 @@ int main(int argc, char **argv)
 			printf("\t[-s source_address]\n");
 			printf("\t[-I iterations]\n");
 			printf("\t[-S transfer_size or 'all']\n");
+			printf("\t[-S start:end[:xN|:+N][,...]] size sweep, e.g. 64:1m:x2\n");
+			printf("\t[-V] verify received payloads\n");
+			printf("\t[-F context|msg|data|tagged] cq entry format\n");
+			printf("\t[-q, --cq=split|shared] separate send and receive cqs or one for both,\n");
+			printf("\t\treporting message rate and cq polls per message\n");
+			printf("\t[--time=seconds] soak at one size, reporting every interval\n");
+			printf("\t[--interval=seconds] soak report interval (default: 1)\n");
+			printf("\t[--all-providers] run over every matching provider and compare\n");
 			exit(1);
 		}
 	}
@@ -625,6 +1102,6 @@ int main(int argc, char **argv)
 	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
 	hints.addr_format = FI_SOCKADDR;
 
-	ret = run();
+	ret = all_providers ? run_all() : run();
 	return ret;
 }
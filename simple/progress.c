@@ -0,0 +1,792 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compute overlap under each data progress model.  The client streams a
+ * window of sends to the server (the target) and waits for its ack.
+ * The target first just polls for the messages, giving the transfer
+ * time, then does a fixed amount of busy work per iteration, polling
+ * only a few times in between.  If the provider moves data while the
+ * target computes, an iteration takes about as long as the longer of
+ * the two; if not, it takes their sum.
+ *
+ * -m auto asks for FI_PROGRESS_AUTO, -m manual for FI_PROGRESS_MANUAL,
+ * and -m thread for manual progress driven by a dedicated thread on the
+ * target that reads its completion queue.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_cm.h>
+#include <shared.h>
+
+#define ACK_SIZE 4
+
+enum progress_mode {
+	MODE_AUTO,
+	MODE_MANUAL,
+	MODE_THREAD,
+	MODE_MAX
+};
+
+static const char *mode_str[] = {
+	[MODE_AUTO] = "auto",
+	[MODE_MANUAL] = "manual",
+	[MODE_THREAD] = "thread",
+};
+
+static int iterations = 100;
+static int transfer_size = 65536;
+static int window = 16;
+static int polls = 10;
+static double work_usec;
+static enum progress_mode mode = MODE_MANUAL;
+static double loops_per_usec;
+static int send_credits;
+static void *buf;
+static size_t buffer_size;
+
+/* receive completions, reaped by the target or its progress thread */
+static volatile int recv_cnt;
+static volatile int thread_stop, thread_err;
+static int recv_expected;
+static pthread_t thread;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *dst_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_pep *pep;
+static struct fid_domain *dom;
+static struct fid_ep *ep;
+static struct fid_eq *cmeq;
+static struct fid_cq *rcq, *scq;
+static struct fid_mr *mr;
+
+static int post_recv(void)
+{
+	int ret;
+
+	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int post_send(size_t size)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	while (!send_credits) {
+		ret = fi_cq_read(scq, &comp, 1);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+		send_credits += ret;
+	}
+
+	ret = fi_send(ep, buf, size, fi_mr_desc(mr), NULL);
+	if (ret)
+		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
+	else
+		send_credits--;
+	return ret;
+}
+
+static int wait_sends(void)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	while (send_credits < window) {
+		ret = fi_cq_read(scq, &comp, 1);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+		send_credits += ret;
+	}
+	return 0;
+}
+
+/* Reaps whatever receive completions are ready. */
+static int reap_recvs(void)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	do {
+		ret = fi_cq_read(rcq, &comp, 1);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+		recv_cnt += ret;
+	} while (ret);
+	return 0;
+}
+
+static void *progress_thread(void *arg)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	while (!thread_stop) {
+		ret = fi_cq_read(rcq, &comp, 1);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			thread_err = ret;
+			break;
+		}
+		if (ret)
+			__sync_fetch_and_add(&recv_cnt, ret);
+	}
+	return NULL;
+}
+
+/*
+ * Waits for cnt more messages, doing usec of busy work in polls chunks
+ * first, and replaces the receives they consumed.
+ */
+static int wait_recvs(int cnt, double usec)
+{
+	uint64_t chunk = usec * loops_per_usec / polls;
+	int ret, i;
+
+	recv_expected += cnt;
+	for (i = 0; usec && i < polls; i++) {
+		work_run(chunk);
+		if (mode != MODE_THREAD) {
+			ret = reap_recvs();
+			if (ret)
+				return ret;
+		}
+	}
+
+	while (recv_cnt < recv_expected) {
+		if (mode == MODE_THREAD) {
+			if (thread_err)
+				return thread_err;
+			continue;
+		}
+		ret = reap_recvs();
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		ret = post_recv();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int server_phase(double usec)
+{
+	int ret, i;
+
+	for (i = 0; i < iterations; i++) {
+		ret = wait_recvs(window, usec);
+		if (ret)
+			return ret;
+		ret = post_send(ACK_SIZE);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int server_test(void)
+{
+	int ret;
+
+	/* one receive more than the window for the client's work message */
+	ret = post_recv();
+	if (ret)
+		return ret;
+
+	loops_per_usec = work_calibrate();
+	if (mode == MODE_THREAD) {
+		ret = pthread_create(&thread, NULL, progress_thread, NULL);
+		if (ret) {
+			printf("pthread_create %s\n", strerror(ret));
+			return -ret;
+		}
+	}
+
+	ret = server_phase(0);
+	if (ret)
+		goto out;
+
+	/* the client sends the work per iteration once it knows the comm time */
+	ret = wait_recvs(1, 0);
+	if (ret)
+		goto out;
+	ret = server_phase(*(double *) buf);
+out:
+	if (mode == MODE_THREAD) {
+		thread_stop = 1;
+		pthread_join(thread, NULL);
+	}
+	return ret;
+}
+
+/* Average time of an iteration: a window of sends and the target's ack. */
+static int client_phase(double *usec)
+{
+	struct fi_cq_entry comp;
+	double start;
+	int ret, i, j;
+
+	start = get_usec();
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < window; j++) {
+			ret = post_send(transfer_size);
+			if (ret)
+				return ret;
+		}
+
+		do {
+			ret = fi_cq_read(rcq, &comp, 1);
+			if (ret < 0) {
+				printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+				return ret;
+			}
+		} while (!ret);
+
+		ret = post_recv();
+		if (ret)
+			return ret;
+	}
+	*usec = (get_usec() - start) / iterations;
+	return 0;
+}
+
+static int client_test(void)
+{
+	double comm, total, overlap;
+	long long bytes = (long long) transfer_size * window;
+	char str[32];
+	int ret;
+
+	ret = client_phase(&comm);
+	if (ret)
+		return ret;
+
+	if (!work_usec)
+		work_usec = comm;
+	*(double *) buf = work_usec;
+	ret = post_send(sizeof(double));
+	if (ret)
+		return ret;
+
+	ret = client_phase(&total);
+	if (ret)
+		return ret;
+
+	size_str(str, sizeof str, transfer_size);
+	printf("progress %s, %s x %d per iteration, %d iterations\n",
+	       mode_str[mode], str, window, iterations);
+	printf("target work %.2f usec per iteration, polling %d times\n",
+	       work_usec, polls);
+	printf("%-10s%14s%12s\n", "phase", "usec/iter", "MB/sec");
+	printf("%-10s%14.2f%12.2f\n", "comm", comm, bytes / comm);
+	printf("%-10s%14.2f%12s\n", "compute", work_usec, "-");
+	printf("%-10s%14.2f%12.2f\n", "overlap", total, bytes / total);
+
+	overlap = 100. * (comm + work_usec - total) / MIN(comm, work_usec);
+	printf("overlap %.0f%%\n", MAX(0, MIN(overlap, 100)));
+	return 0;
+}
+
+static void free_lres(void)
+{
+	fi_close(&cmeq->fid);
+}
+
+static int alloc_cm_res(void)
+{
+	struct fi_eq_attr cm_attr;
+	int ret;
+
+	memset(&cm_attr, 0, sizeof cm_attr);
+	cm_attr.wait_obj = FI_WAIT_FD;
+	ret = fi_eq_open(fab, &cm_attr, &cmeq, NULL);
+	if (ret)
+		printf("fi_eq_open cm %s\n", fi_strerror(-ret));
+
+	return ret;
+}
+
+static void free_ep_res(void)
+{
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	free(buf);
+}
+
+static int alloc_ep_res(struct fi_info *fi)
+{
+	struct fi_cq_attr cq_attr;
+	int ret;
+
+	buffer_size = MAX(transfer_size, sizeof(double));
+	buf = malloc(buffer_size);
+	if (!buf) {
+		perror("malloc");
+		return -FI_ENOMEM;
+	}
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = window << 1;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	if (!cmeq) {
+		ret = alloc_cm_res();
+		if (ret)
+			goto err4;
+	}
+
+	return 0;
+
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	free(buf);
+	return ret;
+}
+
+/* Both sides keep a full window of receives posted at all times. */
+static int bind_ep_res(void)
+{
+	int ret, i;
+
+	ret = fi_bind(&ep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_enable(ep);
+	if (ret)
+		return ret;
+
+	send_credits = window;
+	for (i = 0; i < window; i++) {
+		ret = post_recv();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int server_listen(void)
+{
+	struct fi_info *fi;
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_pendpoint(fab, fi, &pep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_cm_res();
+	if (ret)
+		goto err2;
+
+	ret = fi_bind(&pep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = fi_listen(pep);
+	if (ret) {
+		printf("fi_listen %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	fi_freeinfo(fi);
+	return 0;
+err3:
+	free_lres();
+err2:
+	fi_close(&pep->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int server_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *info = NULL;
+	ssize_t rd;
+	int ret;
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		return (int) rd;
+	}
+
+	if (event != FI_CONNREQ) {
+		printf("Unexpected CM event %d\n", event);
+		ret = -FI_EOTHER;
+		goto err1;
+	}
+
+	info = entry.info;
+	ret = fi_domain(fab, info, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_endpoint(dom, info, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint for req %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_ep_res(info);
+	if (ret)
+		 goto err2;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err3;
+
+	ret = fi_accept(ep, NULL, 0);
+	if (ret) {
+		printf("fi_accept %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		goto err3;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err3;
+	}
+
+	fi_freeinfo(info);
+	return 0;
+
+err3:
+	free_ep_res();
+err2:
+	fi_close(&ep->fid);
+err1:
+	fi_reject(pep, info->connreq, NULL, 0);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int client_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *fi;
+	ssize_t rd;
+	int ret;
+
+	if (src_addr) {
+		ret = getaddr(src_addr, NULL, (struct sockaddr **) &hints.src_addr,
+			      (socklen_t *) &hints.src_addrlen);
+		if (ret)
+			printf("source address error %s\n", gai_strerror(ret));
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err2;
+	}
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err4;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err5;
+
+	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
+	if (ret) {
+		printf("fi_connect %s\n", fi_strerror(-ret));
+		goto err5;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_condread %zd %s\n", rd, fi_strerror((int) -rd));
+		ret = (int) rd;
+		goto err5;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err5;
+	}
+
+	if (hints.src_addr)
+		free(hints.src_addr);
+	fi_freeinfo(fi);
+	return 0;
+
+err5:
+	free_ep_res();
+err4:
+	fi_close(&ep->fid);
+err3:
+	fi_close(&dom->fid);
+err2:
+	fi_close(&fab->fid);
+err1:
+	fi_freeinfo(fi);
+err0:
+	if (hints.src_addr)
+		free(hints.src_addr);
+	return ret;
+}
+
+static int run(void)
+{
+	int ret;
+
+	if (!dst_addr) {
+		ret = server_listen();
+		if (ret)
+			return ret;
+	}
+
+	ret = dst_addr ? client_connect() : server_connect();
+	if (ret)
+		return ret;
+
+	ret = dst_addr ? client_test() : server_test();
+	if (!ret)
+		ret = wait_sends();
+
+	fi_shutdown(ep, 0);
+	fi_close(&ep->fid);
+	free_ep_res();
+	if (!dst_addr)
+		free_lres();
+	fi_close(&dom->fid);
+	fi_close(&fab->fid);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int op;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:I:S:w:c:P:m:")) != -1) {
+		switch (op) {
+		case 'd':
+			dst_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'I':
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			transfer_size = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'c':
+			work_usec = atof(optarg);
+			break;
+		case 'P':
+			polls = atoi(optarg);
+			break;
+		case 'm':
+			for (mode = 0; mode < MODE_MAX; mode++) {
+				if (!strcasecmp(mode_str[mode], optarg))
+					break;
+			}
+			if (mode == MODE_MAX) {
+				printf("unknown progress mode %s\n", optarg);
+				goto usage;
+			}
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (iterations < 1 || transfer_size < 1 || window < 1 || polls < 1 ||
+	    work_usec < 0) {
+		printf("iterations, size, window and polls must be positive\n");
+		goto usage;
+	}
+
+	domain_hints.data_progress = mode == MODE_AUTO ?
+				     FI_PROGRESS_AUTO : FI_PROGRESS_MANUAL;
+	if (mode == MODE_THREAD)
+		domain_hints.threading = FI_THREAD_SAFE;
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_MSG;
+	hints.caps = FI_MSG;
+	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
+	hints.addr_format = FI_SOCKADDR;
+
+	return run();
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d destination_address]\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p port_number]\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-I iterations (default 100)]\n");
+	printf("\t[-S transfer_size (default 65536)]\n");
+	printf("\t[-w sends per iteration (default 16)]\n");
+	printf("\t[-c target work in usec per iteration (default: the comm time)]\n");
+	printf("\t[-P target polls per iteration while working (default 10)]\n");
+	printf("\t[-m auto|manual|thread (progress model, default manual)]\n");
+	exit(1);
+}
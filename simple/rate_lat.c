@@ -0,0 +1,1049 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Open-loop latency under load.  The client issues requests on a fixed
+ * schedule (constant spacing or Poisson arrivals) regardless of when
+ * replies come back, and measures each request's latency from its
+ * scheduled send time.  A request that could not be sent on time
+ * because the client was stalled or out of credits is charged for the
+ * wait, which avoids the coordinated omission a closed-loop pingpong
+ * suffers from.  The server simply echoes every request.
+ *
+ * Without -R the client first finds the peak rate by sending as fast
+ * as the window allows, then sweeps the offered load from 1/N to N/N
+ * of that peak.
+ *
+ * Request sizes can be drawn from a distribution (-D) or replayed
+ * together with their inter-arrival gaps from a trace (-T), in which
+ * case latency is also broken down by power-of-two size class.  The
+ * server echoes each request at the size it arrived with, so it needs
+ * the same -S, -D or -T to size its receive buffers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_cm.h>
+#include <shared.h>
+
+enum arrival {
+	ARRIVAL_CONST,
+	ARRIVAL_POISSON,
+	ARRIVAL_MAX
+};
+
+static const char *arrival_str[] = {
+	[ARRIVAL_CONST] = "const",
+	[ARRIVAL_POISSON] = "poisson",
+};
+
+static int iterations = 10000;
+static int transfer_size = 64;
+static int window = 64;
+static int steps = 10;
+static double max_rate;
+static enum arrival arrival = ARRIVAL_POISSON;
+static int send_credits;
+static double *sched, *lat;
+static int *req_size;
+static unsigned short rand_state[3];
+static void *buf;
+static size_t buffer_size;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *dst_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_pep *pep;
+static struct fid_domain *dom;
+static struct fid_ep *ep;
+static struct fid_eq *cmeq;
+static struct fid_cq *rcq, *scq;
+static struct fid_mr *mr;
+
+/* request sizes are drawn from a cumulative distribution */
+struct size_bin {
+	int size;
+	double cum;
+};
+
+static struct size_bin *bins;
+static int nbins;
+static int max_size;
+
+/* or replayed from a trace of size and gap (usec) pairs */
+static int *trace_size;
+static double *trace_gap;
+static int trace_len;
+
+static int size_class(int size)
+{
+	int c = 0;
+
+	while ((1 << c) < size)
+		c++;
+	return c;
+}
+
+/* Latency of each power-of-two size class, from the unsorted samples. */
+static void show_classes(void)
+{
+	double *cls;
+	char str[16];
+	int c, i, n;
+
+	cls = malloc(iterations * sizeof *cls);
+	if (!cls)
+		return;
+
+	for (c = 0; c <= size_class(max_size); c++) {
+		for (i = n = 0; i < iterations; i++) {
+			if (size_class(req_size[i]) == c)
+				cls[n++] = lat[i];
+		}
+		if (!n)
+			continue;
+
+		qsort(cls, n, sizeof *cls, cmp_double);
+		size_str(str, sizeof str, 1LL << c);
+		printf("  <=%-6s%12d%12s%8s%10s%10.2f%10.2f%10.2f%10.2f%10.2f\n",
+		       str, n, "", "", "", percentile(cls, n, 0.5),
+		       percentile(cls, n, 0.9), percentile(cls, n, 0.99),
+		       percentile(cls, n, 0.999), cls[n - 1]);
+	}
+	free(cls);
+}
+
+static void show_perf(const char *name, double offered, double usec)
+{
+	double achieved = iterations / usec * 1000000.;
+	long long bytes = 0;
+	int i;
+
+	for (i = 0; i < iterations; i++)
+		bytes += req_size[i];
+
+	/* name offered achieved load MB/sec p50 p90 p99 p99.9 max */
+	printf("%-10s", name);
+	if (offered)
+		printf("%12.0f", offered);
+	else
+		printf("%12s", "-");
+	printf("%12.0f", achieved);
+	if (offered)
+		printf("%7.0f%%", 100. * achieved / offered);
+	else
+		printf("%8s", "-");
+	printf("%10.2f", bytes / usec);
+
+	if (nbins > 1 || trace_len) {
+		printf("\n");
+		show_classes();
+		printf("  %-8s%12d%12s%8s%10s", "all", iterations, "", "", "");
+	}
+
+	qsort(lat, iterations, sizeof *lat, cmp_double);
+	printf("%10.2f%10.2f%10.2f%10.2f%10.2f\n",
+		percentile(lat, iterations, 0.5),
+		percentile(lat, iterations, 0.9),
+		percentile(lat, iterations, 0.99),
+		percentile(lat, iterations, 0.999),
+		lat[iterations - 1]);
+}
+
+static int next_size(int i)
+{
+	double u;
+	int lo = 0, hi = nbins - 1, mid;
+
+	if (trace_len)
+		return trace_size[i % trace_len];
+
+	u = erand48(rand_state);
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (bins[mid].cum > u)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return bins[lo].size;
+}
+
+/* Time to the next request in usec, or 0 to send back to back. */
+static double next_gap(double rate, int i)
+{
+	if (trace_len)
+		return trace_gap[i % trace_len];
+	if (!rate)
+		return 0;
+	if (arrival == ARRIVAL_CONST)
+		return 1000000. / rate;
+	return -log(1. - erand48(rand_state)) * 1000000. / rate;
+}
+
+static int post_recv(void)
+{
+	int ret;
+
+	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int post_send(size_t size)
+{
+	int ret;
+
+	ret = fi_send(ep, buf, size, fi_mr_desc(mr), NULL);
+	if (ret)
+		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
+	else
+		send_credits--;
+	return ret;
+}
+
+/*
+ * Returns 1 if a completion was reaped, 0 if none, or an error.  The
+ * length of a received message is returned through len.
+ */
+static int poll_cq(struct fid_cq *cq, size_t *len)
+{
+	struct fi_cq_msg_entry comp;
+	int ret;
+
+	ret = fi_cq_read(cq, &comp, 1);
+	if (ret < 0)
+		printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+	else if (ret > 0 && len)
+		*len = comp.len;
+	return ret;
+}
+
+static int wait_send_credits(int credits)
+{
+	int ret;
+
+	while (send_credits < credits) {
+		ret = poll_cq(scq, NULL);
+		if (ret < 0)
+			return ret;
+		send_credits += ret;
+	}
+	return 0;
+}
+
+static int wait_send_credit(void)
+{
+	return wait_send_credits(1);
+}
+
+/*
+ * Runs one load step of iterations requests offered at rate (requests
+ * per second, 0 for back to back).  Latency counts from the scheduled
+ * send time, or from the actual send when back to back.  Returns the
+ * time from the first scheduled send to the last reply in *usec.
+ */
+static int run_step(double rate, double *usec)
+{
+	double start, now, next;
+	int sent = 0, done = 0, ret;
+
+	start = get_usec();
+	next = start;
+	while (done < iterations) {
+		if (sent < iterations && sent - done < window) {
+			now = get_usec();
+			if (now >= next) {
+				ret = wait_send_credit();
+				if (ret)
+					return ret;
+				req_size[sent] = next_size(sent);
+				/* back to back requests have no schedule to lag */
+				sched[sent] = rate || trace_len ? next : get_usec();
+				ret = post_send(req_size[sent]);
+				if (ret)
+					return ret;
+				next += next_gap(rate, sent);
+				sent++;
+			}
+		}
+
+		ret = poll_cq(scq, NULL);
+		if (ret < 0)
+			return ret;
+		send_credits += ret;
+
+		ret = poll_cq(rcq, NULL);
+		if (ret < 0)
+			return ret;
+		if (ret) {
+			lat[done] = get_usec() - sched[done];
+			done++;
+			ret = post_recv();
+			if (ret)
+				return ret;
+		}
+	}
+
+	*usec = get_usec() - start;
+	return 0;
+}
+
+static int client_test(void)
+{
+	double usec, rate;
+	char name[16];
+	int ret, i;
+
+	if (trace_len)
+		steps = 1;
+
+	/* the server learns how many requests to echo */
+	*(int *) buf = (max_rate || trace_len ? steps : steps + 1) * iterations;
+	ret = wait_send_credit();
+	if (ret)
+		return ret;
+	ret = post_send(sizeof(int));
+	if (ret)
+		return ret;
+
+	do {
+		ret = poll_cq(rcq, NULL);
+		if (ret < 0)
+			return ret;
+	} while (!ret);
+	ret = post_recv();
+	if (ret)
+		return ret;
+
+	if (trace_len) {
+		ret = run_step(0, &usec);
+		if (ret)
+			return ret;
+		show_perf("trace", 0, usec);
+		return 0;
+	}
+
+	if (!max_rate) {
+		ret = run_step(0, &usec);
+		if (ret)
+			return ret;
+		show_perf("peak", 0, usec);
+		max_rate = iterations / usec * 1000000.;
+	}
+
+	for (i = 1; i <= steps; i++) {
+		rate = max_rate * i / steps;
+		ret = run_step(rate, &usec);
+		if (ret)
+			return ret;
+		snprintf(name, sizeof name, "%d%%", i * 100 / steps);
+		show_perf(name, rate, usec);
+	}
+	return 0;
+}
+
+static int server_test(void)
+{
+	int ret, total, done = 0;
+	size_t len = 0;
+
+	do {
+		ret = poll_cq(rcq, NULL);
+		if (ret < 0)
+			return ret;
+	} while (!ret);
+	total = *(int *) buf;
+	ret = post_recv();
+	if (ret)
+		return ret;
+
+	/* the client waits for this before sending requests */
+	ret = post_send(sizeof(int));
+	if (ret)
+		return ret;
+
+	while (done < total) {
+		ret = poll_cq(scq, NULL);
+		if (ret < 0)
+			return ret;
+		send_credits += ret;
+
+		ret = poll_cq(rcq, &len);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			continue;
+
+		ret = post_recv();
+		if (ret)
+			return ret;
+		ret = wait_send_credit();
+		if (ret)
+			return ret;
+		ret = post_send(len);
+		if (ret)
+			return ret;
+		done++;
+	}
+	return 0;
+}
+
+static void free_lres(void)
+{
+	fi_close(&cmeq->fid);
+}
+
+static int alloc_cm_res(void)
+{
+	struct fi_eq_attr cm_attr;
+	int ret;
+
+	memset(&cm_attr, 0, sizeof cm_attr);
+	cm_attr.wait_obj = FI_WAIT_FD;
+	ret = fi_eq_open(fab, &cm_attr, &cmeq, NULL);
+	if (ret)
+		printf("fi_eq_open cm %s\n", fi_strerror(-ret));
+
+	return ret;
+}
+
+static void free_ep_res(void)
+{
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	free(req_size);
+	free(lat);
+	free(sched);
+	free(buf);
+}
+
+static int alloc_ep_res(struct fi_info *fi)
+{
+	struct fi_cq_attr cq_attr;
+	int ret;
+
+	buffer_size = MAX(max_size, sizeof(int));
+	buf = malloc(buffer_size);
+	sched = calloc(iterations, sizeof *sched);
+	lat = calloc(iterations, sizeof *lat);
+	req_size = calloc(iterations, sizeof *req_size);
+	if (!buf || !sched || !lat || !req_size) {
+		perror("malloc");
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_MSG;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = window << 1;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	if (!cmeq) {
+		ret = alloc_cm_res();
+		if (ret)
+			goto err4;
+	}
+
+	return 0;
+
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	free(req_size);
+	free(lat);
+	free(sched);
+	free(buf);
+	return ret;
+}
+
+/* Both sides keep a full window of receives posted at all times. */
+static int bind_ep_res(void)
+{
+	int ret, i;
+
+	ret = fi_bind(&ep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_enable(ep);
+	if (ret)
+		return ret;
+
+	send_credits = window;
+	for (i = 0; i < window; i++) {
+		ret = post_recv();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int server_listen(void)
+{
+	struct fi_info *fi;
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_pendpoint(fab, fi, &pep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_cm_res();
+	if (ret)
+		goto err2;
+
+	ret = fi_bind(&pep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = fi_listen(pep);
+	if (ret) {
+		printf("fi_listen %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	fi_freeinfo(fi);
+	return 0;
+err3:
+	free_lres();
+err2:
+	fi_close(&pep->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int server_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *info = NULL;
+	ssize_t rd;
+	int ret;
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		return (int) rd;
+	}
+
+	if (event != FI_CONNREQ) {
+		printf("Unexpected CM event %d\n", event);
+		ret = -FI_EOTHER;
+		goto err1;
+	}
+
+	info = entry.info;
+	ret = fi_domain(fab, info, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_endpoint(dom, info, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint for req %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_ep_res(info);
+	if (ret)
+		 goto err2;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err3;
+
+	ret = fi_accept(ep, NULL, 0);
+	if (ret) {
+		printf("fi_accept %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		goto err3;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err3;
+	}
+
+	fi_freeinfo(info);
+	return 0;
+
+err3:
+	free_ep_res();
+err2:
+	fi_close(&ep->fid);
+err1:
+	fi_reject(pep, info->connreq, NULL, 0);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int client_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *fi;
+	ssize_t rd;
+	int ret;
+
+	if (src_addr) {
+		ret = getaddr(src_addr, NULL, (struct sockaddr **) &hints.src_addr,
+			      (socklen_t *) &hints.src_addrlen);
+		if (ret)
+			printf("source address error %s\n", gai_strerror(ret));
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err2;
+	}
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err4;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err5;
+
+	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
+	if (ret) {
+		printf("fi_connect %s\n", fi_strerror(-ret));
+		goto err5;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_condread %zd %s\n", rd, fi_strerror((int) -rd));
+		ret = (int) rd;
+		goto err5;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err5;
+	}
+
+	if (hints.src_addr)
+		free(hints.src_addr);
+	fi_freeinfo(fi);
+	return 0;
+
+err5:
+	free_ep_res();
+err4:
+	fi_close(&ep->fid);
+err3:
+	fi_close(&dom->fid);
+err2:
+	fi_close(&fab->fid);
+err1:
+	fi_freeinfo(fi);
+err0:
+	if (hints.src_addr)
+		free(hints.src_addr);
+	return ret;
+}
+
+static int run(void)
+{
+	int ret = 0;
+
+	if (!dst_addr) {
+		ret = server_listen();
+		if (ret)
+			return ret;
+	}
+
+	ret = dst_addr ? client_connect() : server_connect();
+	if (ret)
+		return ret;
+
+	if (dst_addr) {
+		if (trace_len)
+			printf("trace of %d requests, ", trace_len);
+		else
+			printf("%s arrivals, ", arrival_str[arrival]);
+		if (nbins > 1 || trace_len)
+			printf("sizes up to %d bytes", max_size);
+		else
+			printf("%d byte requests", max_size);
+		printf(", %d per step, window %d, latency in usec\n",
+		       iterations, window);
+		printf("%-10s%12s%12s%8s%10s%10s%10s%10s%10s%10s\n", "load",
+		       "offered/s", "achieved/s", "ratio", "MB/sec", "p50",
+		       "p90", "p99", "p99.9", "max");
+	}
+
+	ret = dst_addr ? client_test() : server_test();
+	if (!ret)
+		ret = wait_send_credits(window);
+
+	fi_shutdown(ep, 0);
+	fi_close(&ep->fid);
+	free_ep_res();
+	if (!dst_addr)
+		free_lres();
+	fi_close(&dom->fid);
+	fi_close(&fab->fid);
+	return ret;
+}
+
+static int add_bin(int size, double weight)
+{
+	struct size_bin *b;
+
+	if (size < 1) {
+		printf("invalid request size %d\n", size);
+		return -FI_EINVAL;
+	}
+
+	b = realloc(bins, (nbins + 1) * sizeof *bins);
+	if (!b)
+		return -FI_ENOMEM;
+	bins = b;
+	bins[nbins].size = size;
+	bins[nbins].cum = weight + (nbins ? bins[nbins - 1].cum : 0);
+	nbins++;
+	max_size = MAX(max_size, size);
+	return 0;
+}
+
+/* Reads "size cumulative_probability" lines of an empirical CDF. */
+static int load_cdf(const char *name)
+{
+	FILE *f;
+	int size, ret = 0;
+	double cum, prev = 0;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		return -FI_EINVAL;
+	}
+
+	while (!ret && fscanf(f, "%d %lf", &size, &cum) == 2) {
+		if (cum < prev) {
+			printf("CDF %s is not monotonic at size %d\n", name, size);
+			ret = -FI_EINVAL;
+			break;
+		}
+		ret = add_bin(size, cum - prev);
+		prev = cum;
+	}
+	fclose(f);
+	return ret;
+}
+
+/*
+ * Builds the cumulative size table from one of
+ *   fixed, bimodal:small:large:p_large, zipf:min:max:s or cdf:file
+ */
+static int init_sizes(const char *dist)
+{
+	int small, large, ret, i;
+	double p, zs;
+
+	if (!strcasecmp(dist, "fixed")) {
+		ret = add_bin(transfer_size, 1);
+	} else if (sscanf(dist, "bimodal:%d:%d:%lf", &small, &large, &p) == 3) {
+		if (p < 0 || p > 1) {
+			printf("bimodal probability must be between 0 and 1\n");
+			return -FI_EINVAL;
+		}
+		ret = add_bin(small, 1 - p);
+		if (!ret)
+			ret = add_bin(large, p);
+	} else if (sscanf(dist, "zipf:%d:%d:%lf", &small, &large, &zs) == 3) {
+		if (small < 1 || large < small) {
+			printf("invalid zipf size range\n");
+			return -FI_EINVAL;
+		}
+		/* the k-th power of two above min has weight 1 / k^s */
+		for (ret = 0, i = 1; !ret && small <= large; small <<= 1, i++)
+			ret = add_bin(small, 1. / pow(i, zs));
+	} else if (!strncasecmp(dist, "cdf:", 4)) {
+		ret = load_cdf(dist + 4);
+	} else {
+		printf("unknown size distribution %s\n", dist);
+		return -FI_EINVAL;
+	}
+
+	if (ret)
+		return ret;
+	if (!nbins || bins[nbins - 1].cum <= 0) {
+		printf("empty size distribution\n");
+		return -FI_EINVAL;
+	}
+
+	for (i = 0; i < nbins; i++)
+		bins[i].cum /= bins[nbins - 1].cum;
+	return 0;
+}
+
+/* Reads "size gap_usec" lines, replayed in order and wrapped as needed. */
+static int load_trace(const char *name)
+{
+	FILE *f;
+	int size, ret = 0;
+	double gap;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		return -FI_EINVAL;
+	}
+
+	while (fscanf(f, "%d %lf", &size, &gap) == 2) {
+		if (size < 1 || gap < 0) {
+			printf("invalid trace entry %d %f\n", size, gap);
+			ret = -FI_EINVAL;
+			break;
+		}
+		trace_size = realloc(trace_size,
+				     (trace_len + 1) * sizeof *trace_size);
+		trace_gap = realloc(trace_gap,
+				    (trace_len + 1) * sizeof *trace_gap);
+		if (!trace_size || !trace_gap) {
+			ret = -FI_ENOMEM;
+			break;
+		}
+		trace_size[trace_len] = size;
+		trace_gap[trace_len++] = gap;
+		max_size = MAX(max_size, size);
+	}
+	fclose(f);
+
+	if (!ret && !trace_len) {
+		printf("empty trace %s\n", name);
+		ret = -FI_EINVAL;
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	char *dist = "fixed", *trace = NULL;
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:I:S:w:R:N:a:D:T:")) != -1) {
+		switch (op) {
+		case 'd':
+			dst_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'I':
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			transfer_size = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'R':
+			max_rate = atof(optarg);
+			break;
+		case 'N':
+			steps = atoi(optarg);
+			break;
+		case 'a':
+			for (arrival = 0; arrival < ARRIVAL_MAX; arrival++) {
+				if (!strcasecmp(arrival_str[arrival], optarg))
+					break;
+			}
+			if (arrival == ARRIVAL_MAX) {
+				printf("unknown arrival process %s\n", optarg);
+				goto usage;
+			}
+			break;
+		case 'D':
+			dist = optarg;
+			break;
+		case 'T':
+			trace = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (iterations < 1 || window < 1 || steps < 1 || max_rate < 0) {
+		printf("iterations, window and steps must be positive\n");
+		goto usage;
+	}
+
+	ret = trace ? load_trace(trace) : init_sizes(dist);
+	if (ret)
+		return ret;
+
+	rand_state[0] = (unsigned short) getpid();
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_MSG;
+	hints.caps = FI_MSG;
+	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
+	hints.addr_format = FI_SOCKADDR;
+
+	return run();
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d destination_address]\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p port_number]\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-I requests per load step (default 10000)]\n");
+	printf("\t[-S transfer_size (default 64)]\n");
+	printf("\t[-w max outstanding requests (default 64)]\n");
+	printf("\t[-R peak rate in requests/sec (default: measured)]\n");
+	printf("\t[-N load steps up to the peak rate (default 10)]\n");
+	printf("\t[-a const|poisson (arrival process, default poisson)]\n");
+	printf("\t[-D fixed|bimodal:small:large:p_large|zipf:min:max:s|"
+	       "cdf:file\n\t    (request size distribution, default fixed)]\n");
+	printf("\t[-T trace file of \"size gap_usec\" lines to replay]\n");
+	exit(1);
+}
@@ -0,0 +1,697 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares one scalable endpoint with K transmit and receive contexts
+ * against K independent endpoints.  Each context (or endpoint) is
+ * driven by its own thread, talking to the matching thread in the
+ * peer process.  Peers exchange addresses through the TCP rendezvous.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <shared.h>
+
+#define MAX_ADDR_LEN 64
+
+enum ep_mode {
+	MODE_SEP,
+	MODE_EP,
+	MODE_MAX
+};
+
+static const char *mode_str[] = {
+	[MODE_SEP] = "sep",
+	[MODE_EP] = "ep",
+};
+
+struct thread_ctx {
+	pthread_t thread;
+	int id;
+	struct fid_ep *tx, *rx;
+	struct fid_cq *scq, *rcq;
+	fi_addr_t dest;
+	char *sbuf, *rbuf;
+	float lat_usec;
+	float rate_usec;
+	int ret;
+};
+
+static int iterations = 10000;
+static int transfer_size = 64;
+static int max_credits = 64;
+static int ctx_cnt = 4;
+static int rx_ctx_bits;
+static int sel_mode = -1;
+static int rank, nranks = 2;
+
+static void *buf;
+static size_t buffer_size;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *rdv_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_domain *dom;
+static struct fid_ep *sep;
+static struct fid_ep **eps;
+static struct fid_av *av;
+static struct fid_mr *mr;
+static struct thread_ctx *threads;
+
+static float elapsed(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000 +
+	       (end->tv_usec - start->tv_usec);
+}
+
+static int post_recv(struct thread_ctx *t)
+{
+	int ret;
+
+	ret = fi_recv(t->rx, t->rbuf, transfer_size, fi_mr_desc(mr), t->rbuf);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int post_send(struct thread_ctx *t)
+{
+	int ret;
+
+	ret = fi_sendto(t->tx, t->sbuf, transfer_size, fi_mr_desc(mr), t->dest, NULL);
+	if (ret)
+		printf("fi_sendto %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int pingpong(struct thread_ctx *t)
+{
+	struct timeval start, end;
+	int i, ret;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		if ((ret = post_recv(t)))
+			return ret;
+
+		if (rank) {
+			if ((ret = post_send(t)) || (ret = wait_for_completion(t->scq, 1)) ||
+			    (ret = wait_for_completion(t->rcq, 1)))
+				return ret;
+		} else {
+			if ((ret = wait_for_completion(t->rcq, 1)) || (ret = post_send(t)) ||
+			    (ret = wait_for_completion(t->scq, 1)))
+				return ret;
+		}
+	}
+	gettimeofday(&end, NULL);
+
+	t->lat_usec = elapsed(&start, &end) / iterations / 2;
+	return 0;
+}
+
+/*
+ * Rank 1 streams to rank 0.  The receiver pre-posts its window before
+ * sending a go message, and acknowledges the last arrival.
+ */
+static int stream(struct thread_ctx *t)
+{
+	struct fi_cq_entry comp;
+	struct timeval start, end;
+	int sent, scomp, rposted, rcomp, ret;
+
+	if (rank) {
+		/* go and ack messages */
+		if ((ret = post_recv(t)) || (ret = post_recv(t)) ||
+		    (ret = wait_for_completion(t->rcq, 1)))
+			return ret;
+
+		gettimeofday(&start, NULL);
+		for (sent = scomp = 0; scomp < iterations; ) {
+			if (sent < iterations && sent - scomp < max_credits) {
+				if ((ret = post_send(t)))
+					return ret;
+				sent++;
+			}
+
+			ret = fi_cq_read(t->scq, &comp, 1);
+			if (ret > 0) {
+				scomp++;
+			} else if (ret < 0) {
+				printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+				return ret;
+			}
+		}
+
+		if ((ret = wait_for_completion(t->rcq, 1)))
+			return ret;
+		gettimeofday(&end, NULL);
+	} else {
+		for (rposted = 0; rposted < MIN(iterations, max_credits); rposted++) {
+			if ((ret = post_recv(t)))
+				return ret;
+		}
+
+		if ((ret = post_send(t)) || (ret = wait_for_completion(t->scq, 1)))
+			return ret;
+
+		gettimeofday(&start, NULL);
+		for (rcomp = 0; rcomp < iterations; ) {
+			ret = fi_cq_read(t->rcq, &comp, 1);
+			if (ret > 0) {
+				rcomp++;
+				if (rposted < iterations) {
+					if ((ret = post_recv(t)))
+						return ret;
+					rposted++;
+				}
+			} else if (ret < 0) {
+				printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+				return ret;
+			}
+		}
+		gettimeofday(&end, NULL);
+
+		if ((ret = post_send(t)) || (ret = wait_for_completion(t->scq, 1)))
+			return ret;
+	}
+
+	t->rate_usec = elapsed(&start, &end);
+	return 0;
+}
+
+static void *run_thread(void *arg)
+{
+	struct thread_ctx *t = arg;
+
+	t->ret = pingpong(t);
+	if (!t->ret)
+		t->ret = stream(t);
+	return NULL;
+}
+
+static void show_perf(enum ep_mode mode)
+{
+	char str[32];
+	float max_usec = 0, lat = 0, max_lat = 0;
+	int i;
+
+	for (i = 0; i < ctx_cnt; i++) {
+		max_usec = MAX(max_usec, threads[i].rate_usec);
+		max_lat = MAX(max_lat, threads[i].lat_usec);
+		lat += threads[i].lat_usec;
+	}
+
+	printf("%-6s%6d  ", mode_str[mode], ctx_cnt);
+	size_str(str, sizeof str, transfer_size);
+	printf("%-8s", str);
+	cnt_str(str, sizeof str, iterations);
+	printf("%-8s", str);
+	printf("%10.3f%10.2f%11.2f%11.2f\n",
+		(float) iterations * ctx_cnt / max_usec,
+		(float) iterations * ctx_cnt * transfer_size / max_usec,
+		lat / ctx_cnt, max_lat);
+}
+
+static void free_mode_res(void)
+{
+	int i;
+
+	for (i = 0; i < ctx_cnt; i++) {
+		if (sep) {
+			if (threads[i].tx)
+				fi_close(&threads[i].tx->fid);
+			if (threads[i].rx)
+				fi_close(&threads[i].rx->fid);
+		} else if (eps && eps[i]) {
+			fi_close(&eps[i]->fid);
+		}
+	}
+
+	if (sep) {
+		fi_close(&sep->fid);
+		sep = NULL;
+	}
+	free(eps);
+	eps = NULL;
+
+	for (i = 0; i < ctx_cnt; i++) {
+		if (threads[i].scq)
+			fi_close(&threads[i].scq->fid);
+		if (threads[i].rcq)
+			fi_close(&threads[i].rcq->fid);
+	}
+	memset(threads, 0, sizeof *threads * ctx_cnt);
+
+	if (av) {
+		fi_close(&av->fid);
+		av = NULL;
+	}
+}
+
+static int alloc_thread_res(struct thread_ctx *t)
+{
+	struct fi_cq_attr cq_attr;
+	int ret;
+
+	t->sbuf = (char *) buf + (size_t) t->id * 2 * transfer_size;
+	t->rbuf = t->sbuf + transfer_size;
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = max_credits << 1;
+	ret = fi_cq_open(dom, &cq_attr, &t->scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &t->rcq, NULL);
+	if (ret)
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+	return ret;
+}
+
+static int open_av(int bits)
+{
+	struct fi_av_attr av_attr;
+	int ret;
+
+	memset(&av_attr, 0, sizeof av_attr);
+	av_attr.type = FI_AV_MAP;
+	av_attr.count = ctx_cnt * nranks;
+	av_attr.rx_ctx_bits = bits;
+	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	if (ret)
+		printf("fi_av_open %s\n", fi_strerror(-ret));
+	return ret;
+}
+
+/* exchange cnt names starting at fid names[0], return peer fi_addrs */
+static int exchange_names(struct fid **fids, int cnt, fi_addr_t *peer)
+{
+	char *names, *all;
+	size_t len;
+	int i, ret;
+
+	names = calloc(cnt, MAX_ADDR_LEN);
+	all = calloc(cnt * nranks, MAX_ADDR_LEN);
+	if (!names || !all) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		len = MAX_ADDR_LEN;
+		ret = fi_getname(fids[i], names + i * MAX_ADDR_LEN, &len);
+		if (ret) {
+			printf("fi_getname %s\n", fi_strerror(-ret));
+			goto out;
+		}
+	}
+
+	ret = rdv_allgather(names, all, cnt * MAX_ADDR_LEN);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < cnt; i++) {
+		ret = fi_av_insert(av, all + ((1 - rank) * cnt + i) * MAX_ADDR_LEN,
+				   1, &peer[i], 0, NULL);
+		if (ret < 0) {
+			printf("fi_av_insert %s\n", fi_strerror(-ret));
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	free(names);
+	free(all);
+	return ret;
+}
+
+static int setup_sep(struct fi_info *fi)
+{
+	struct fid *fid;
+	fi_addr_t peer;
+	int i, ret;
+
+	ret = fi_scalable_ep(dom, fi, &sep, NULL);
+	if (ret) {
+		printf("fi_scalable_ep %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = open_av(rx_ctx_bits);
+	if (ret)
+		return ret;
+
+	ret = bind_fid(&sep->fid, &av->fid, 0);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ctx_cnt; i++) {
+		threads[i].id = i;
+		ret = alloc_thread_res(&threads[i]);
+		if (ret)
+			return ret;
+
+		ret = fi_tx_context(sep, i, NULL, &threads[i].tx, NULL);
+		if (ret) {
+			printf("fi_tx_context %s\n", fi_strerror(-ret));
+			return ret;
+		}
+
+		ret = fi_rx_context(sep, i, NULL, &threads[i].rx, NULL);
+		if (ret) {
+			printf("fi_rx_context %s\n", fi_strerror(-ret));
+			return ret;
+		}
+
+		if ((ret = bind_fid(&threads[i].tx->fid, &threads[i].scq->fid, FI_SEND)) ||
+		    (ret = bind_fid(&threads[i].rx->fid, &threads[i].rcq->fid, FI_RECV)))
+			return ret;
+
+		if ((ret = fi_enable(threads[i].tx)) || (ret = fi_enable(threads[i].rx))) {
+			printf("fi_enable %s\n", fi_strerror(-ret));
+			return ret;
+		}
+	}
+
+	ret = fi_enable(sep);
+	if (ret) {
+		printf("fi_enable %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	fid = &sep->fid;
+	ret = exchange_names(&fid, 1, &peer);
+	if (ret)
+		return ret;
+
+	/* thread i sends to receive context i of the peer */
+	for (i = 0; i < ctx_cnt; i++)
+		threads[i].dest = rx_ctx_bits ? fi_rx_addr(peer, i, rx_ctx_bits) : peer;
+	return 0;
+}
+
+static int setup_eps(struct fi_info *fi)
+{
+	struct fid **fids;
+	fi_addr_t *peers;
+	size_t tx_cnt, rx_cnt;
+	int i, ret;
+
+	eps = calloc(ctx_cnt, sizeof *eps);
+	fids = calloc(ctx_cnt, sizeof *fids);
+	peers = calloc(ctx_cnt, sizeof *peers);
+	if (!eps || !fids || !peers) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	ret = open_av(0);
+	if (ret)
+		goto out;
+
+	/* regular endpoints carry a single transmit and receive context */
+	tx_cnt = fi->ep_attr->tx_ctx_cnt;
+	rx_cnt = fi->ep_attr->rx_ctx_cnt;
+	fi->ep_attr->tx_ctx_cnt = fi->ep_attr->rx_ctx_cnt = 1;
+	fi->caps &= ~FI_NAMED_RX_CTX;
+
+	for (i = 0; i < ctx_cnt; i++) {
+		ret = fi_endpoint(dom, fi, &eps[i], NULL);
+		if (ret) {
+			printf("fi_endpoint %s\n", fi_strerror(-ret));
+			break;
+		}
+
+		threads[i].id = i;
+		threads[i].tx = threads[i].rx = eps[i];
+		ret = alloc_thread_res(&threads[i]);
+		if (ret)
+			break;
+
+		if ((ret = bind_fid(&eps[i]->fid, &threads[i].scq->fid, FI_SEND)) ||
+		    (ret = bind_fid(&eps[i]->fid, &threads[i].rcq->fid, FI_RECV)) ||
+		    (ret = bind_fid(&eps[i]->fid, &av->fid, 0)))
+			break;
+
+		ret = fi_enable(eps[i]);
+		if (ret) {
+			printf("fi_enable %s\n", fi_strerror(-ret));
+			break;
+		}
+		fids[i] = &eps[i]->fid;
+	}
+
+	fi->ep_attr->tx_ctx_cnt = tx_cnt;
+	fi->ep_attr->rx_ctx_cnt = rx_cnt;
+	fi->caps |= FI_NAMED_RX_CTX;
+	if (ret)
+		goto out;
+
+	ret = exchange_names(fids, ctx_cnt, peers);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < ctx_cnt; i++)
+		threads[i].dest = peers[i];
+out:
+	free(fids);
+	free(peers);
+	return ret;
+}
+
+static int run_mode(struct fi_info *fi, enum ep_mode mode)
+{
+	int i, ret;
+
+	ret = mode == MODE_SEP ? setup_sep(fi) : setup_eps(fi);
+	if (ret)
+		goto out;
+
+	ret = rdv_barrier();
+	if (ret)
+		goto out;
+
+	for (i = 0; i < ctx_cnt; i++) {
+		ret = pthread_create(&threads[i].thread, NULL, run_thread, &threads[i]);
+		if (ret) {
+			printf("pthread_create %s\n", strerror(ret));
+			break;
+		}
+	}
+
+	while (i--) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].ret)
+			ret = threads[i].ret;
+	}
+
+	if (!ret)
+		show_perf(mode);
+
+	rdv_barrier();
+out:
+	free_mode_res();
+	return ret;
+}
+
+static int run(void)
+{
+	struct fi_info *fi;
+	int mode, ret = 0;
+
+	ret = rdv_init(rdv_addr, port, &rank, &nranks);
+	if (ret)
+		return ret;
+
+	if (nranks != 2) {
+		printf("scalable endpoint test runs between 2 processes\n");
+		ret = -FI_EINVAL;
+		goto out;
+	}
+
+	for (rx_ctx_bits = 0; (1 << rx_ctx_bits) < ctx_cnt; rx_ctx_bits++)
+		;
+	ep_hints.tx_ctx_cnt = ctx_cnt;
+	ep_hints.rx_ctx_cnt = ctx_cnt;
+
+	threads = calloc(ctx_cnt, sizeof *threads);
+	buffer_size = (size_t) ctx_cnt * 2 * transfer_size;
+	buf = malloc(buffer_size);
+	if (!threads || !buf) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, NULL, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		goto out;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_domain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err1;
+	}
+
+	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	printf("%-6s%6s  %-8s%-8s%10s%10s%11s%11s\n", "mode", "ctxs",
+	       "bytes", "iters", "Mmsg/sec", "MB/sec", "avg usec", "max usec");
+
+	for (mode = 0; mode < MODE_MAX; mode++) {
+		if (sel_mode >= 0 && mode != sel_mode)
+			continue;
+		ret = run_mode(fi, mode);
+		if (ret)
+			break;
+	}
+
+	fi_close(&mr->fid);
+err2:
+	fi_close(&dom->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+out:
+	free(threads);
+	free(buf);
+	rdv_close();
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:K:m:I:S:w:")) != -1) {
+		switch (op) {
+		case 'd':
+			rdv_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'K':
+			ctx_cnt = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcasecmp(optarg, "sep"))
+				sel_mode = MODE_SEP;
+			else if (!strcasecmp(optarg, "ep"))
+				sel_mode = MODE_EP;
+			else
+				goto usage;
+			break;
+		case 'I':
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			transfer_size = atoi(optarg);
+			break;
+		case 'w':
+			max_credits = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (ctx_cnt < 1)
+		goto usage;
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_RDM;
+	hints.caps = FI_MSG | FI_NAMED_RX_CTX;
+	hints.mode = FI_LOCAL_MR;
+	hints.addr_format = FI_SOCKADDR;
+	/* each thread drives its own context and CQs of a shared endpoint */
+	domain_hints.threading = FI_THREAD_COMPLETION;
+
+	ret = run();
+	return ret;
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d rendezvous_address] (client only)\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p rendezvous_port] (default: 9228)\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-K contexts] threads, tx/rx contexts or endpoints (default: 4)\n");
+	printf("\t[-m sep|ep] (default: both)\n");
+	printf("\t[-I iterations] (default: 10000)\n");
+	printf("\t[-S transfer_size] (default: 64)\n");
+	printf("\t[-w window] outstanding sends and receives (default: 64)\n");
+	exit(1);
+}
@@ -0,0 +1,863 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Measures how a shared receive context scales with the number of
+ * connections.  The client opens up to C connections to the server and
+ * spreads its traffic across them.  With -m shared the server's
+ * endpoints post into one receive pool (fi_srx_context) and transmit
+ * through one shared context (fi_stx_context); with -m private every
+ * connection gets its own rx_depth receive buffers.  For each
+ * connection count the client reports the memory held by the server's
+ * posted buffers next to the message rate and round trip latency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_cm.h>
+#include <shared.h>
+
+enum msg_op {
+	MSG_PING,
+	MSG_DATA,
+	MSG_ACK
+};
+
+struct msg_hdr {
+	uint32_t conn;
+	uint32_t op;
+};
+
+struct ack_msg {
+	struct msg_hdr hdr;
+	uint64_t posted_bufs;
+	uint64_t posted_bytes;
+	uint32_t shared;
+};
+
+struct rx_slot {
+	int conn;
+	char *buf;
+};
+
+static int iterations = 10000;
+static int transfer_size = 64;
+static int max_conns = 16;
+static int rx_depth = 128;
+static int window = 64;
+static int shared = 1;
+static int conns;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *dst_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_pep *pep;
+static struct fid_domain *dom;
+static struct fid_ep **eps;
+static struct fid_ep *srx;
+static struct fid_stx *stx;
+static struct fid_eq *cmeq;
+static struct fid_cq *rcq, *scq;
+static struct fid_mr *mr;
+static struct fi_info *fi;
+
+static void *buf;
+static size_t buffer_size;
+static struct rx_slot *slots;
+static int nslots;
+static char *tx_buf;
+
+static int posted_bufs(void)
+{
+	return shared ? rx_depth : conns * rx_depth;
+}
+
+static int post_recv(struct rx_slot *slot)
+{
+	int ret;
+
+	ret = fi_recv(shared && !dst_addr ? srx : eps[slot->conn], slot->buf,
+		      transfer_size, fi_mr_desc(mr), slot);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int post_send(int conn, void *msg, size_t len)
+{
+	int ret;
+
+	ret = fi_send(eps[conn], msg, len, fi_mr_desc(mr), NULL);
+	if (ret)
+		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int read_recv(struct rx_slot **slot)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	do {
+		ret = fi_cq_read(rcq, &comp, 1);
+		if (ret < 0) {
+			printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+	} while (!ret);
+
+	*slot = comp.op_context;
+	return 0;
+}
+
+static float elapsed(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000 +
+	       (end->tv_usec - start->tv_usec);
+}
+
+static void show_perf(struct ack_msg *ack, float lat_usec, float rate_usec)
+{
+	char str[32];
+
+	/* conns mode bufs posted bytes iters Mmsg/s usec/xfer */
+	printf("%-8d%-10s", conns, ack->shared ? "shared" : "private");
+	cnt_str(str, sizeof str, ack->posted_bufs);
+	printf("%-8s", str);
+	size_str(str, sizeof str, ack->posted_bytes);
+	printf("%-8s", str);
+	size_str(str, sizeof str, transfer_size);
+	printf("%-8s", str);
+	cnt_str(str, sizeof str, iterations);
+	printf("%-8s", str);
+	printf("%10.3f%11.2f\n", iterations / rate_usec,
+		lat_usec / iterations / 2);
+}
+
+static int client_test(void)
+{
+	struct timeval start, end;
+	struct rx_slot *slot;
+	struct msg_hdr *hdr;
+	struct ack_msg ack;
+	float lat_usec;
+	int ret, i, out = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		hdr = (struct msg_hdr *) tx_buf;
+		hdr->conn = i % conns;
+		hdr->op = MSG_PING;
+		ret = post_send(hdr->conn, tx_buf, transfer_size);
+		if (ret)
+			return ret;
+
+		ret = wait_for_completion(scq, 1);
+		if (ret)
+			return ret;
+
+		ret = read_recv(&slot);
+		if (ret)
+			return ret;
+
+		ret = post_recv(slot);
+		if (ret)
+			return ret;
+	}
+	gettimeofday(&end, NULL);
+	lat_usec = elapsed(&start, &end);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		if (out == window) {
+			ret = wait_for_completion(scq, 1);
+			if (ret)
+				return ret;
+			out--;
+		}
+
+		hdr = (struct msg_hdr *) (tx_buf + (i % window) * transfer_size);
+		hdr->conn = i % conns;
+		hdr->op = MSG_DATA;
+		ret = post_send(hdr->conn, hdr, transfer_size);
+		if (ret)
+			return ret;
+		out++;
+	}
+
+	ret = wait_for_completion(scq, out);
+	if (ret)
+		return ret;
+
+	ret = read_recv(&slot);
+	if (ret)
+		return ret;
+	gettimeofday(&end, NULL);
+
+	memcpy(&ack, slot->buf, sizeof ack);
+	ret = post_recv(slot);
+	if (ret)
+		return ret;
+
+	if (ack.hdr.op != MSG_ACK) {
+		printf("Unexpected message %d from server\n", ack.hdr.op);
+		return -FI_EOTHER;
+	}
+
+	show_perf(&ack, lat_usec, elapsed(&start, &end));
+	return 0;
+}
+
+static int server_test(void)
+{
+	struct rx_slot *slot;
+	struct msg_hdr hdr;
+	struct ack_msg *ack;
+	int ret, i;
+
+	for (i = 0; i < iterations; i++) {
+		ret = read_recv(&slot);
+		if (ret)
+			return ret;
+
+		memcpy(&hdr, slot->buf, sizeof hdr);
+		ret = post_recv(slot);
+		if (ret)
+			return ret;
+
+		if (hdr.op != MSG_PING || hdr.conn >= conns) {
+			printf("Unexpected message %d on connection %d\n",
+				hdr.op, hdr.conn);
+			return -FI_EOTHER;
+		}
+
+		ret = post_send(hdr.conn, tx_buf, transfer_size);
+		if (ret)
+			return ret;
+
+		ret = wait_for_completion(scq, 1);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		ret = read_recv(&slot);
+		if (ret)
+			return ret;
+
+		ret = post_recv(slot);
+		if (ret)
+			return ret;
+	}
+
+	ack = (struct ack_msg *) tx_buf;
+	memset(ack, 0, sizeof *ack);
+	ack->hdr.op = MSG_ACK;
+	ack->posted_bufs = posted_bufs();
+	ack->posted_bytes = (uint64_t) posted_bufs() * transfer_size;
+	ack->shared = shared;
+	ret = post_send(0, ack, transfer_size);
+	if (ret)
+		return ret;
+
+	return wait_for_completion(scq, 1);
+}
+
+static void free_lres(void)
+{
+	fi_close(&cmeq->fid);
+}
+
+static int alloc_cm_res(void)
+{
+	struct fi_eq_attr cm_attr;
+	int ret;
+
+	memset(&cm_attr, 0, sizeof cm_attr);
+	cm_attr.wait_obj = FI_WAIT_FD;
+	ret = fi_eq_open(fab, &cm_attr, &cmeq, NULL);
+	if (ret)
+		printf("fi_eq_open cm %s\n", fi_strerror(-ret));
+
+	return ret;
+}
+
+static void free_ep_res(void)
+{
+	if (srx)
+		fi_close(&srx->fid);
+	if (stx)
+		fi_close(&stx->fid);
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	free(slots);
+	free(buf);
+}
+
+/*
+ * The server needs rx_depth buffers per connection in private mode,
+ * but only rx_depth in total when they are posted to the shared
+ * receive context.  The client keeps one receive per connection for
+ * replies.  Both sides send out of window slots following the
+ * receive buffers.
+ */
+static int alloc_ep_res(struct fi_info *info)
+{
+	struct fi_cq_attr cq_attr;
+	struct fi_rx_attr rx_attr;
+	struct fi_tx_attr tx_attr;
+	int i, ret;
+
+	if (dst_addr)
+		nslots = max_conns;
+	else
+		nslots = shared ? rx_depth : max_conns * rx_depth;
+
+	buffer_size = (size_t) (nslots + window) * transfer_size;
+	buf = malloc(buffer_size);
+	slots = calloc(nslots, sizeof *slots);
+	if (!buf || !slots) {
+		perror("malloc");
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+	tx_buf = (char *) buf + (size_t) nslots * transfer_size;
+
+	for (i = 0; i < nslots; i++) {
+		slots[i].conn = dst_addr ? i : (shared ? 0 : i / rx_depth);
+		slots[i].buf = (char *) buf + (size_t) i * transfer_size;
+	}
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = window + 1;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	cq_attr.size = nslots;
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	if (dst_addr || !shared)
+		return 0;
+
+	rx_attr = *info->rx_attr;
+	rx_attr.size = rx_depth;
+	ret = fi_srx_context(dom, &rx_attr, &srx, NULL);
+	if (ret) {
+		printf("fi_srx_context %s\n", fi_strerror(-ret));
+		goto err4;
+	}
+
+	tx_attr = *info->tx_attr;
+	tx_attr.size = window + 1;
+	ret = fi_stx_context(dom, &tx_attr, &stx, NULL);
+	if (ret) {
+		printf("fi_stx_context %s\n", fi_strerror(-ret));
+		goto err5;
+	}
+
+	return 0;
+
+err5:
+	fi_close(&srx->fid);
+	srx = NULL;
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	free(slots);
+	free(buf);
+	return ret;
+}
+
+static int bind_ep_res(struct fid_ep *ep)
+{
+	int ret;
+
+	ret = fi_bind(&ep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	if (srx) {
+		ret = fi_bind(&ep->fid, &srx->fid, 0);
+		if (ret) {
+			printf("fi_bind srx %s\n", fi_strerror(-ret));
+			return ret;
+		}
+
+		ret = fi_bind(&ep->fid, &stx->fid, 0);
+		if (ret) {
+			printf("fi_bind stx %s\n", fi_strerror(-ret));
+			return ret;
+		}
+	}
+
+	ret = fi_enable(ep);
+	if (ret)
+		printf("fi_enable %s\n", fi_strerror(-ret));
+
+	return ret;
+}
+
+static int wait_connected(struct fid_ep *ep)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	ssize_t rd;
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		return (int) rd;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		return -FI_EOTHER;
+	}
+
+	return 0;
+}
+
+static int server_listen(void)
+{
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_pendpoint(fab, fi, &pep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_cm_res();
+	if (ret)
+		goto err2;
+
+	ret = fi_bind(&pep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = fi_listen(pep);
+	if (ret) {
+		printf("fi_listen %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	return 0;
+err3:
+	free_lres();
+err2:
+	fi_close(&pep->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int server_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *info = NULL;
+	struct fid_ep *ep;
+	ssize_t rd;
+	int i, ret;
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		return (int) rd;
+	}
+
+	if (event != FI_CONNREQ) {
+		printf("Unexpected CM event %d\n", event);
+		return -FI_EOTHER;
+	}
+
+	info = entry.info;
+	if (!dom) {
+		ret = fi_domain(fab, info, &dom, NULL);
+		if (ret) {
+			printf("fi_fdomain %s\n", fi_strerror(-ret));
+			goto err1;
+		}
+
+		ret = alloc_ep_res(info);
+		if (ret)
+			goto err1;
+
+		for (i = 0; shared && i < nslots; i++) {
+			ret = post_recv(&slots[i]);
+			if (ret)
+				goto err1;
+		}
+	}
+
+	if (shared) {
+		info->ep_attr->tx_ctx_cnt = FI_SHARED_CONTEXT;
+		info->ep_attr->rx_ctx_cnt = FI_SHARED_CONTEXT;
+	}
+
+	ret = fi_endpoint(dom, info, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint for req %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+	eps[conns] = ep;
+
+	ret = bind_ep_res(ep);
+	if (ret)
+		goto err2;
+
+	for (i = 0; !shared && i < rx_depth; i++) {
+		ret = post_recv(&slots[conns * rx_depth + i]);
+		if (ret)
+			goto err2;
+	}
+
+	ret = fi_accept(ep, NULL, 0);
+	if (ret) {
+		printf("fi_accept %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = wait_connected(ep);
+	if (ret)
+		goto err2;
+
+	conns++;
+	fi_freeinfo(info);
+	return 0;
+
+err2:
+	fi_close(&ep->fid);
+err1:
+	fi_reject(pep, info->connreq, NULL, 0);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int client_open(void)
+{
+	int ret;
+
+	if (src_addr) {
+		ret = getaddr(src_addr, NULL, (struct sockaddr **) &hints.src_addr,
+			      (socklen_t *) &hints.src_addrlen);
+		if (ret)
+			printf("source address error %s\n", gai_strerror(ret));
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err2;
+	}
+
+	ret = alloc_cm_res();
+	if (ret)
+		goto err3;
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err4;
+
+	if (hints.src_addr)
+		free(hints.src_addr);
+	return 0;
+
+err4:
+	free_lres();
+err3:
+	fi_close(&dom->fid);
+err2:
+	fi_close(&fab->fid);
+err1:
+	fi_freeinfo(fi);
+err0:
+	if (hints.src_addr)
+		free(hints.src_addr);
+	return ret;
+}
+
+static int client_connect(void)
+{
+	struct fid_ep *ep;
+	int ret;
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		return ret;
+	}
+	eps[conns] = ep;
+
+	ret = bind_ep_res(ep);
+	if (ret)
+		goto err;
+
+	ret = post_recv(&slots[conns]);
+	if (ret)
+		goto err;
+
+	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
+	if (ret) {
+		printf("fi_connect %s\n", fi_strerror(-ret));
+		goto err;
+	}
+
+	ret = wait_connected(ep);
+	if (ret)
+		goto err;
+
+	conns++;
+	return 0;
+err:
+	fi_close(&ep->fid);
+	return ret;
+}
+
+static int run(void)
+{
+	int i, target, ret = 0;
+
+	eps = calloc(max_conns, sizeof *eps);
+	if (!eps) {
+		perror("calloc");
+		return -FI_ENOMEM;
+	}
+
+	ret = dst_addr ? client_open() : server_listen();
+	if (ret)
+		goto out;
+
+	if (dst_addr)
+		printf("%-8s%-10s%-8s%-8s%-8s%-8s%10s%11s\n", "conns", "mode",
+		       "bufs", "posted", "bytes", "iters", "Mmsg/s", "usec/xfer");
+
+	for (target = 1; ; target = MIN(target << 1, max_conns)) {
+		while (conns < target) {
+			ret = dst_addr ? client_connect() : server_connect();
+			if (ret)
+				goto close;
+		}
+
+		ret = dst_addr ? client_test() : server_test();
+		if (ret)
+			goto close;
+
+		if (target == max_conns)
+			break;
+	}
+
+close:
+	for (i = 0; i < conns; i++) {
+		fi_shutdown(eps[i], 0);
+		fi_close(&eps[i]->fid);
+	}
+	if (dom) {
+		free_ep_res();
+		fi_close(&dom->fid);
+	}
+	free_lres();
+	if (!dst_addr)
+		fi_close(&pep->fid);
+	fi_close(&fab->fid);
+	fi_freeinfo(fi);
+out:
+	free(eps);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int op;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:C:r:m:I:S:w:")) != -1) {
+		switch (op) {
+		case 'd':
+			dst_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'C':
+			max_conns = atoi(optarg);
+			break;
+		case 'r':
+			rx_depth = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcasecmp("shared", optarg)) {
+				shared = 1;
+			} else if (!strcasecmp("private", optarg)) {
+				shared = 0;
+			} else {
+				printf("unknown mode %s\n", optarg);
+				goto usage;
+			}
+			break;
+		case 'I':
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			transfer_size = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (max_conns < 1 || rx_depth < 1 || window < 1 || iterations < 1) {
+		printf("connections, rx depth, window and iterations must be positive\n");
+		goto usage;
+	}
+
+	if (transfer_size < (int) sizeof(struct ack_msg)) {
+		printf("transfer size must be at least %zu bytes\n",
+			sizeof(struct ack_msg));
+		goto usage;
+	}
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_MSG;
+	hints.caps = FI_MSG;
+	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
+	hints.addr_format = FI_SOCKADDR;
+
+	return run();
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d destination_address]\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p port_number]\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-C max_connections (default 16)]\n");
+	printf("\t[-r rx_depth (default 128)]\n");
+	printf("\t[-m shared|private (server receive pool, default shared)]\n");
+	printf("\t[-I iterations]\n");
+	printf("\t[-S transfer_size]\n");
+	printf("\t[-w send_window (default 64)]\n");
+	exit(1);
+}
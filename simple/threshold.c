@@ -0,0 +1,678 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Protocol threshold discovery.  Sweeps message sizes densely, probing
+ * each with fi_send pingpong latency and streaming bandwidth, and flags
+ * the sizes where either curve jumps.  Such discontinuities are where
+ * the provider switches from inject to eager to rendezvous transfers.
+ * They are listed next to the inject_size and max_msg_size the provider
+ * advertises.
+ *
+ * Latency is the median half round trip of a size.  Between adjacent
+ * sizes it may grow at most in proportion to the size; any growth
+ * beyond that by more than the jump percentage is reported.  Bandwidth
+ * is reported when it drops by more than the jump percentage.  Both
+ * sides must be given the same -S and -I.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_cm.h>
+#include <shared.h>
+
+#define MAX_ITERATIONS 10000
+
+static int iterations;
+static int window = 64;
+static double jump = 20;
+static double *rtt;
+static double *lat, *mbps;
+static void *buf;
+static size_t buffer_size;
+static size_t inject_size, max_msg_size;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *dst_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_pep *pep;
+static struct fid_domain *dom;
+static struct fid_ep *ep;
+static struct fid_eq *cmeq;
+static struct fid_cq *rcq, *scq;
+static struct fid_mr *mr;
+static struct msg_window win;
+
+/*
+ * The default sweep takes every size up to 16 bytes and 8 evenly spaced
+ * sizes per power of two above that, up to 4 MB.
+ */
+static int init_sweep(void)
+{
+	char spec[1024];
+	int len, size;
+
+	len = snprintf(spec, sizeof spec, "1:15:+1");
+	for (size = 16; size < (1 << 22); size <<= 1) {
+		len += snprintf(spec + len, sizeof spec - len, ",%d:%d:+%d",
+				size, 2 * size - size / 8, size / 8);
+	}
+	snprintf(spec + len, sizeof spec - len, ",%d", 1 << 22);
+	return set_test_sizes(spec);
+}
+
+/* Median half round trip of size byte pingpongs. */
+static int probe_lat(int size, double *usec)
+{
+	double t0;
+	int ret, i, cnt = probe_count(size, iterations);
+
+	for (i = 0; i < cnt; i++) {
+		t0 = get_usec();
+		if (dst_addr) {
+			ret = win_post_send(&win, size, NULL);
+			if (!ret)
+				ret = win_wait_recv(&win, NULL);
+		} else {
+			ret = win_wait_recv(&win, NULL);
+			if (!ret)
+				ret = win_post_send(&win, size, NULL);
+		}
+		if (ret)
+			return ret;
+		rtt[i] = get_usec() - t0;
+	}
+
+	*usec = median(rtt, cnt) / 2;
+	return 0;
+}
+
+static int probe_bw(int size, double *mb_sec)
+{
+	double usec;
+	int ret, cnt = probe_count(size, iterations);
+
+	ret = win_stream(&win, dst_addr != NULL, size, cnt, &usec);
+	if (!ret)
+		*mb_sec = (double) cnt * size / usec;
+	return ret;
+}
+
+/* Latency growth beyond what the size growth explains, in percent. */
+static double lat_jump(int i)
+{
+	double scale = (double) test_size[i].size / test_size[i - 1].size;
+
+	return 100. * (lat[i] - lat[i - 1] * scale) / lat[i - 1];
+}
+
+static double bw_drop(int i)
+{
+	return 100. * (mbps[i - 1] - mbps[i]) / mbps[i - 1];
+}
+
+static void show_limit(const char *name, size_t limit, int i)
+{
+	if (limit >= (size_t) test_size[i - 1].size &&
+	    limit < (size_t) test_size[i].size)
+		printf("  [%s]", name);
+}
+
+static void show_thresholds(int cnt)
+{
+	char str[32], prev[32];
+	int i, found = 0;
+
+	printf("\nthresholds (jumps over %.0f%%):\n", jump);
+	for (i = 1; i < cnt; i++) {
+		if (lat_jump(i) <= jump && bw_drop(i) <= jump)
+			continue;
+
+		found++;
+		size_str(prev, sizeof prev, test_size[i - 1].size);
+		size_str(str, sizeof str, test_size[i].size);
+		printf("  %s -> %s:", prev, str);
+		if (lat_jump(i) > jump)
+			printf(" latency %+.2f usec (%+.0f%%)",
+			       lat[i] - lat[i - 1], 100. * (lat[i] - lat[i - 1]) /
+			       lat[i - 1]);
+		if (bw_drop(i) > jump)
+			printf(" bandwidth %+.0f%%", -bw_drop(i));
+		show_limit("inject_size", inject_size, i);
+		show_limit("max_msg_size", max_msg_size, i);
+		printf("\n");
+	}
+	if (!found)
+		printf("  none found\n");
+}
+
+static int run_sweep(void)
+{
+	char str[32];
+	int ret, i, cnt = 0;
+
+	if (dst_addr) {
+		size_str(str, sizeof str, inject_size);
+		printf("advertised: inject_size %s", str);
+		size_str(str, sizeof str, max_msg_size);
+		printf(", max_msg_size %s\n", str);
+		printf("%-10s%12s%12s\n", "bytes", "usec", "MB/sec");
+	}
+
+	for (i = 0; i < TEST_CNT; i++) {
+		if (max_msg_size && test_size[i].size > max_msg_size)
+			break;
+
+		ret = win_sync(&win, dst_addr != NULL);
+		if (!ret)
+			ret = probe_lat(test_size[i].size, &lat[i]);
+		if (!ret)
+			ret = win_sync(&win, dst_addr != NULL);
+		if (!ret)
+			ret = probe_bw(test_size[i].size, &mbps[i]);
+		if (ret)
+			return ret;
+		cnt++;
+
+		if (!dst_addr)
+			continue;
+		size_str(str, sizeof str, test_size[i].size);
+		printf("%-10s%12.2f%12.2f", str, lat[i], mbps[i]);
+		if (i && lat_jump(i) > jump)
+			printf("  <- latency");
+		if (i && bw_drop(i) > jump)
+			printf("  <- bandwidth");
+		printf("\n");
+	}
+
+	if (dst_addr)
+		show_thresholds(cnt);
+	return win_wait_sends(&win);
+}
+
+static void free_lres(void)
+{
+	fi_close(&cmeq->fid);
+}
+
+static int alloc_cm_res(void)
+{
+	struct fi_eq_attr cm_attr;
+	int ret;
+
+	memset(&cm_attr, 0, sizeof cm_attr);
+	cm_attr.wait_obj = FI_WAIT_FD;
+	ret = fi_eq_open(fab, &cm_attr, &cmeq, NULL);
+	if (ret)
+		printf("fi_eq_open cm %s\n", fi_strerror(-ret));
+
+	return ret;
+}
+
+static void free_ep_res(void)
+{
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	free(mbps);
+	free(lat);
+	free(rtt);
+	free(buf);
+}
+
+static int alloc_ep_res(struct fi_info *fi)
+{
+	struct fi_cq_attr cq_attr;
+	int ret;
+
+	inject_size = fi->tx_attr->inject_size;
+	max_msg_size = fi->ep_attr->max_msg_size;
+
+	buffer_size = max_test_size(0);
+	if (max_msg_size)
+		buffer_size = MIN(buffer_size, max_msg_size);
+	buffer_size = MAX(buffer_size, WIN_SYNC_SIZE);
+	buf = malloc(buffer_size);
+	rtt = calloc(iterations ? iterations : MAX_ITERATIONS, sizeof *rtt);
+	lat = calloc(TEST_CNT, sizeof *lat);
+	mbps = calloc(TEST_CNT, sizeof *mbps);
+	if (!buf || !rtt || !lat || !mbps) {
+		perror("malloc");
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = window << 1;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	if (!cmeq) {
+		ret = alloc_cm_res();
+		if (ret)
+			goto err4;
+	}
+
+	return 0;
+
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	free(mbps);
+	free(lat);
+	free(rtt);
+	free(buf);
+	return ret;
+}
+
+static int bind_ep_res(void)
+{
+	int ret;
+
+	ret = fi_bind(&ep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_enable(ep);
+	if (ret)
+		return ret;
+
+	win.ep = ep;
+	win.scq = scq;
+	win.rcq = rcq;
+	win.mr = mr;
+	win.buf = buf;
+	win.size = buffer_size;
+	win.window = window;
+	return win_init(&win);
+}
+
+static int server_listen(void)
+{
+	struct fi_info *fi;
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_pendpoint(fab, fi, &pep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_cm_res();
+	if (ret)
+		goto err2;
+
+	ret = fi_bind(&pep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = fi_listen(pep);
+	if (ret) {
+		printf("fi_listen %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	fi_freeinfo(fi);
+	return 0;
+err3:
+	free_lres();
+err2:
+	fi_close(&pep->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int server_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *info = NULL;
+	ssize_t rd;
+	int ret;
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		return (int) rd;
+	}
+
+	if (event != FI_CONNREQ) {
+		printf("Unexpected CM event %d\n", event);
+		ret = -FI_EOTHER;
+		goto err1;
+	}
+
+	info = entry.info;
+	ret = fi_domain(fab, info, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_endpoint(dom, info, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint for req %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_ep_res(info);
+	if (ret)
+		 goto err2;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err3;
+
+	ret = fi_accept(ep, NULL, 0);
+	if (ret) {
+		printf("fi_accept %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		goto err3;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err3;
+	}
+
+	fi_freeinfo(info);
+	return 0;
+
+err3:
+	free_ep_res();
+err2:
+	fi_close(&ep->fid);
+err1:
+	fi_reject(pep, info->connreq, NULL, 0);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int client_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *fi;
+	ssize_t rd;
+	int ret;
+
+	if (src_addr) {
+		ret = getaddr(src_addr, NULL, (struct sockaddr **) &hints.src_addr,
+			      (socklen_t *) &hints.src_addrlen);
+		if (ret)
+			printf("source address error %s\n", gai_strerror(ret));
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err2;
+	}
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err4;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err5;
+
+	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
+	if (ret) {
+		printf("fi_connect %s\n", fi_strerror(-ret));
+		goto err5;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_condread %zd %s\n", rd, fi_strerror((int) -rd));
+		ret = (int) rd;
+		goto err5;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err5;
+	}
+
+	if (hints.src_addr)
+		free(hints.src_addr);
+	fi_freeinfo(fi);
+	return 0;
+
+err5:
+	free_ep_res();
+err4:
+	fi_close(&ep->fid);
+err3:
+	fi_close(&dom->fid);
+err2:
+	fi_close(&fab->fid);
+err1:
+	fi_freeinfo(fi);
+err0:
+	if (hints.src_addr)
+		free(hints.src_addr);
+	return ret;
+}
+
+static int run(void)
+{
+	int ret;
+
+	if (!dst_addr) {
+		ret = server_listen();
+		if (ret)
+			return ret;
+	}
+
+	ret = dst_addr ? client_connect() : server_connect();
+	if (ret)
+		return ret;
+
+	ret = run_sweep();
+
+	fi_shutdown(ep, 0);
+	fi_close(&ep->fid);
+	free_ep_res();
+	if (!dst_addr)
+		free_lres();
+	fi_close(&dom->fid);
+	fi_close(&fab->fid);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	char *sizes = NULL;
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:I:S:w:j:")) != -1) {
+		switch (op) {
+		case 'd':
+			dst_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'I':
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			sizes = optarg;
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'j':
+			jump = atof(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (iterations < 0 || window < 1 || jump <= 0) {
+		printf("iterations, window and jump must be positive\n");
+		goto usage;
+	}
+
+	ret = sizes ? set_test_sizes(sizes) : init_sweep();
+	if (ret)
+		return ret;
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_MSG;
+	hints.caps = FI_MSG;
+	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
+	hints.addr_format = FI_SOCKADDR;
+
+	return run();
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d destination_address]\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p port_number]\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-I iterations per size (default: by size)]\n");
+	printf("\t[-S size sweep, e.g. 1k:64k:+256 (default: 1 to 4m, 8 per octave)]\n");
+	printf("\t[-w max outstanding sends (default 64)]\n");
+	printf("\t[-j jump in percent to report (default 20)]\n");
+	exit(1);
+}
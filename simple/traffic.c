@@ -0,0 +1,910 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Multi-process traffic pattern test.  N processes exchange messages
+ * over reliable datagram endpoints following an all-to-all, ring,
+ * shift-by-k or random permutation pattern.  Fabric addresses are
+ * exchanged through a TCP rendezvous with rank 0, so no MPI is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_cm.h>
+#include <shared.h>
+
+#define MAX_ADDR_LEN 64
+
+enum pattern {
+	PAT_ALL2ALL,
+	PAT_RING,
+	PAT_SHIFT,
+	PAT_RANDOM,
+};
+
+static const char *pattern_str[] = {
+	[PAT_ALL2ALL] = "all2all",
+	[PAT_RING] = "ring",
+	[PAT_SHIFT] = "shift",
+	[PAT_RANDOM] = "random",
+};
+
+struct step_perf {
+	float bw_usec;
+	float lat_usec;
+};
+
+static int custom;
+static int custom_iterations;
+static int size_option = SIZE_OPT_DEFAULT;
+static int iterations = 1000;
+static int transfer_size = 1000;
+static int max_credits = 64;
+static int verbose;
+static enum pattern pattern = PAT_ALL2ALL;
+static int shift;
+static int rank, nranks = 2;
+static int *perm, *iperm;
+static struct step_perf *perf, *all_perf;
+static float phase_usec, *all_phase_usec, *pair_usec;
+static void *buf, *rbuf;
+static size_t buffer_size;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *rdv_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_domain *dom;
+static struct fid_ep *ep;
+static struct fid_av *av;
+static struct fid_cq *rcq, *scq;
+static struct fid_mr *mr;
+static fi_addr_t *addrs;
+
+/*
+ * all2all talks to every peer in one concurrent phase, but keeps a
+ * result slot per peer.  shift without a distance walks every distance
+ * one step at a time.
+ */
+static int num_steps(void)
+{
+	return (pattern == PAT_ALL2ALL || (pattern == PAT_SHIFT && !shift)) ?
+		nranks - 1 : 1;
+}
+
+static void get_peers(int me, int step, int *dst, int *src)
+{
+	int k;
+
+	switch (pattern) {
+	case PAT_ALL2ALL:
+		k = step + 1;
+		break;
+	case PAT_RING:
+		k = 1;
+		break;
+	case PAT_SHIFT:
+		k = shift ? shift : step + 1;
+		break;
+	case PAT_RANDOM:
+	default:
+		*dst = perm[me];
+		*src = iperm[me];
+		return;
+	}
+
+	*dst = (me + k) % nranks;
+	*src = (me - k % nranks + nranks) % nranks;
+}
+
+/*
+ * Rank 0 picks the seed, so that every rank builds the same
+ * permutation.  Reject permutations with fixed points, a rank talking
+ * to itself would not exercise the fabric.
+ */
+static int init_perm(void)
+{
+	unsigned int seed, *seeds;
+	int i, j, t, fixed;
+
+	perm = calloc(nranks, sizeof *perm);
+	iperm = calloc(nranks, sizeof *iperm);
+	seeds = calloc(nranks, sizeof *seeds);
+	if (!perm || !iperm || !seeds)
+		return -FI_ENOMEM;
+
+	seed = (unsigned int) time(NULL);
+	if (rdv_allgather(&seed, seeds, sizeof seed)) {
+		free(seeds);
+		return -FI_EOTHER;
+	}
+	seed = seeds[0];
+	free(seeds);
+
+	do {
+		for (i = 0; i < nranks; i++)
+			perm[i] = i;
+		for (i = nranks - 1; i > 0; i--) {
+			j = rand_r(&seed) % (i + 1);
+			t = perm[i];
+			perm[i] = perm[j];
+			perm[j] = t;
+		}
+		for (i = 0, fixed = 0; i < nranks; i++)
+			fixed |= (perm[i] == i);
+	} while (fixed);
+
+	for (i = 0; i < nranks; i++)
+		iperm[perm[i]] = i;
+	return 0;
+}
+
+static void init_test(int size)
+{
+	transfer_size = size;
+	if (!custom_iterations)
+		iterations = size_to_count(transfer_size);
+}
+
+static int post_recv(void)
+{
+	int ret;
+
+	ret = fi_recv(ep, rbuf, transfer_size, fi_mr_desc(mr), rbuf);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int post_send(int dst, void *context)
+{
+	int ret;
+
+	ret = fi_sendto(ep, buf, transfer_size, fi_mr_desc(mr), addrs[dst], context);
+	if (ret)
+		printf("fi_sendto %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int poll_cq(struct fid_cq *cq, int *cnt)
+{
+	struct fi_cq_entry comp[8];
+	int ret;
+
+	ret = fi_cq_read(cq, comp, 8);
+	if (ret > 0) {
+		*cnt += ret;
+	} else if (ret < 0) {
+		printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+	return 0;
+}
+
+/*
+ * Stream 'iterations' messages to dst while receiving the same number
+ * from src, keeping up to max_credits sends and receives outstanding.
+ */
+static int run_step_bw(int dst, int src, float *usec)
+{
+	struct timeval start, end;
+	int sent, scomp, rposted, rcomp;
+	int ret;
+
+	ret = rdv_barrier();
+	if (ret)
+		return ret;
+
+	gettimeofday(&start, NULL);
+	sent = scomp = rposted = rcomp = 0;
+	while (scomp < iterations || rcomp < iterations) {
+		while (rposted < iterations && rposted - rcomp < max_credits) {
+			ret = post_recv();
+			if (ret)
+				return ret;
+			rposted++;
+		}
+
+		while (sent < iterations && sent - scomp < max_credits) {
+			ret = post_send(dst, NULL);
+			if (ret)
+				return ret;
+			sent++;
+		}
+
+		ret = poll_cq(scq, &scomp);
+		if (ret)
+			return ret;
+
+		ret = poll_cq(rcq, &rcomp);
+		if (ret)
+			return ret;
+	}
+	gettimeofday(&end, NULL);
+
+	*usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+	return 0;
+}
+
+/*
+ * Exchange one message at a time: every rank sends to dst and waits
+ * for the message from src before starting the next round.
+ */
+static int run_step_lat(int dst, int src, float *usec)
+{
+	struct timeval start, end;
+	int i, ret;
+
+	ret = rdv_barrier();
+	if (ret)
+		return ret;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		ret = post_recv();
+		if (ret)
+			return ret;
+
+		ret = post_send(dst, NULL);
+		if (ret)
+			return ret;
+
+		ret = wait_for_completion(scq, 1);
+		if (ret)
+			return ret;
+
+		ret = wait_for_completion(rcq, 1);
+		if (ret)
+			return ret;
+	}
+	gettimeofday(&end, NULL);
+
+	*usec = ((end.tv_sec - start.tv_sec) * 1000000 +
+		 (end.tv_usec - start.tv_usec)) / iterations;
+	return 0;
+}
+
+static float elapsed_usec(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_usec - start->tv_usec);
+}
+
+/*
+ * all2all sends carry the result slot of their destination as context,
+ * note when the latest send to each peer completed.
+ */
+static int poll_sends(struct timeval *start, int *cnt)
+{
+	struct fi_cq_entry comp[8];
+	float usec;
+	int i, ret;
+
+	ret = fi_cq_read(scq, comp, 8);
+	if (ret > 0) {
+		usec = elapsed_usec(start);
+		for (i = 0; i < ret; i++)
+			pair_usec[(struct step_perf *) comp[i].op_context - perf] = usec;
+		*cnt += ret;
+	} else if (ret < 0) {
+		printf("Event queue read %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+	return 0;
+}
+
+/*
+ * Exchange one message with every peer at once per round.  A pair's
+ * latency is the time from the start of the round until the send to
+ * that peer completed.
+ */
+static int run_all2all_lat(void)
+{
+	struct timeval start;
+	int i, steps, step, scomp, rcomp, dst, src, ret;
+
+	steps = num_steps();
+	for (step = 0; step < steps; step++)
+		perf[step].lat_usec = 0;
+
+	ret = rdv_barrier();
+	if (ret)
+		return ret;
+
+	for (i = 0; i < iterations; i++) {
+		for (step = 0; step < steps; step++) {
+			ret = post_recv();
+			if (ret)
+				return ret;
+		}
+
+		gettimeofday(&start, NULL);
+		for (step = 0; step < steps; step++) {
+			get_peers(rank, step, &dst, &src);
+			ret = post_send(dst, &perf[step]);
+			if (ret)
+				return ret;
+		}
+
+		for (scomp = rcomp = 0; scomp < steps || rcomp < steps; ) {
+			ret = poll_sends(&start, &scomp);
+			if (ret)
+				return ret;
+
+			ret = poll_cq(rcq, &rcomp);
+			if (ret)
+				return ret;
+		}
+
+		for (step = 0; step < steps; step++)
+			perf[step].lat_usec += pair_usec[step];
+	}
+
+	for (step = 0; step < steps; step++)
+		perf[step].lat_usec /= iterations;
+	return 0;
+}
+
+/*
+ * Stream 'iterations' messages to every peer at once while receiving
+ * as many from each of them.  Sends go round robin over the peers, so
+ * all pairs share the max_credits window for the whole phase.  A pair's
+ * bandwidth is measured up to the completion of its last send.
+ */
+static int run_all2all_bw(void)
+{
+	struct timeval start;
+	int steps, step, total, sent, scomp, rposted, rcomp, dst, src, ret;
+
+	steps = num_steps();
+	total = iterations * steps;
+
+	ret = rdv_barrier();
+	if (ret)
+		return ret;
+
+	gettimeofday(&start, NULL);
+	sent = scomp = rposted = rcomp = 0;
+	while (scomp < total || rcomp < total) {
+		while (rposted < total && rposted - rcomp < max_credits) {
+			ret = post_recv();
+			if (ret)
+				return ret;
+			rposted++;
+		}
+
+		while (sent < total && sent - scomp < max_credits) {
+			step = sent % steps;
+			get_peers(rank, step, &dst, &src);
+			ret = post_send(dst, &perf[step]);
+			if (ret)
+				return ret;
+			sent++;
+		}
+
+		ret = poll_sends(&start, &scomp);
+		if (ret)
+			return ret;
+
+		ret = poll_cq(rcq, &rcomp);
+		if (ret)
+			return ret;
+	}
+	phase_usec = elapsed_usec(&start);
+
+	for (step = 0; step < steps; step++)
+		perf[step].bw_usec = pair_usec[step];
+	return 0;
+}
+
+static void show_perf(void)
+{
+	char str[32];
+	float usec, max_usec, pair_bw, min_bw = 0, max_bw = 0, sum_bw = 0;
+	float lat, max_lat = 0, sum_lat = 0;
+	long long bytes;
+	int steps, step, r, dst, src, pairs;
+
+	steps = num_steps();
+	bytes = (long long) iterations * transfer_size;
+
+	if (pattern == PAT_ALL2ALL) {
+		/* a single concurrent phase, bounded by the slowest rank */
+		for (r = 0, usec = 0; r < nranks; r++)
+			usec = MAX(usec, all_phase_usec[r]);
+	} else {
+		/* the slowest rank of each step, steps are serialized */
+		for (step = 0, usec = 0; step < steps; step++) {
+			for (r = 0, max_usec = 0; r < nranks; r++)
+				max_usec = MAX(max_usec, all_perf[r * steps + step].bw_usec);
+			usec += max_usec;
+		}
+	}
+
+	for (r = 0, pairs = 0; r < nranks; r++) {
+		for (step = 0; step < steps; step++, pairs++) {
+			pair_bw = bytes / all_perf[r * steps + step].bw_usec;
+			lat = all_perf[r * steps + step].lat_usec;
+			if (!pairs || pair_bw < min_bw)
+				min_bw = pair_bw;
+			max_bw = MAX(max_bw, pair_bw);
+			max_lat = MAX(max_lat, lat);
+			sum_bw += pair_bw;
+			sum_lat += lat;
+		}
+	}
+
+	size_str(str, sizeof str, transfer_size);
+	printf("%-8s", str);
+	cnt_str(str, sizeof str, iterations);
+	printf("%-8s", str);
+	size_str(str, sizeof str, bytes * pairs);
+	printf("%-8s", str);
+	printf("%8.2fs%10.2f%10.2f%10.2f%10.2f%11.2f%11.2f\n",
+		usec / 1000000., (bytes * pairs) / usec,
+		min_bw, sum_bw / pairs, max_bw,
+		sum_lat / pairs, max_lat);
+
+	if (!verbose)
+		return;
+
+	/* all2all results are recorded by the sender, others by the receiver */
+	for (r = 0; r < nranks; r++) {
+		for (step = 0; step < steps; step++) {
+			get_peers(r, step, &dst, &src);
+			if (pattern == PAT_ALL2ALL)
+				src = r;
+			else
+				dst = r;
+			printf("    %5d -> %-5d%10.2f MB/sec%11.2f usec/xfer\n", src, dst,
+				bytes / all_perf[r * steps + step].bw_usec,
+				all_perf[r * steps + step].lat_usec);
+		}
+	}
+}
+
+static int run_test(void)
+{
+	int steps, step, dst, src, ret;
+
+	steps = num_steps();
+	if (pattern == PAT_ALL2ALL) {
+		ret = run_all2all_lat();
+		if (ret)
+			return ret;
+
+		ret = run_all2all_bw();
+		if (ret)
+			return ret;
+
+		ret = rdv_allgather(&phase_usec, all_phase_usec, sizeof phase_usec);
+		if (ret)
+			return ret;
+	} else {
+		for (step = 0; step < steps; step++) {
+			get_peers(rank, step, &dst, &src);
+			ret = run_step_lat(dst, src, &perf[step].lat_usec);
+			if (ret)
+				return ret;
+
+			ret = run_step_bw(dst, src, &perf[step].bw_usec);
+			if (ret)
+				return ret;
+		}
+	}
+
+	ret = rdv_allgather(perf, all_perf, sizeof *perf * steps);
+	if (ret)
+		return ret;
+
+	if (!rank)
+		show_perf();
+	return 0;
+}
+
+static void free_ep_res(void)
+{
+	fi_close(&av->fid);
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	free(buf);
+}
+
+static int alloc_ep_res(struct fi_info *fi)
+{
+	struct fi_cq_attr cq_attr;
+	struct fi_av_attr av_attr;
+	int ret;
+
+	buffer_size = !custom ? max_test_size(size_option) : transfer_size;
+	buf = malloc(buffer_size << 1);
+	if (!buf) {
+		perror("malloc");
+		return -1;
+	}
+	rbuf = (char *) buf + buffer_size;
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = MAX(max_credits, nranks) << 1;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, buffer_size << 1, 0, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	memset(&av_attr, 0, sizeof av_attr);
+	av_attr.type = FI_AV_MAP;
+	av_attr.count = nranks;
+	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	if (ret) {
+		printf("fi_av_open %s\n", fi_strerror(-ret));
+		goto err4;
+	}
+
+	return 0;
+
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	free(buf);
+	return ret;
+}
+
+static int bind_ep_res(void)
+{
+	int ret;
+
+	ret = bind_fid(&ep->fid, &scq->fid, FI_SEND);
+	if (ret)
+		return ret;
+
+	ret = bind_fid(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret)
+		return ret;
+
+	ret = bind_fid(&ep->fid, &av->fid, 0);
+	if (ret)
+		return ret;
+
+	ret = fi_enable(ep);
+	if (ret)
+		printf("fi_enable %d (%s)\n", ret, fi_strerror(-ret));
+
+	return ret;
+}
+
+static int exchange_addresses(void)
+{
+	char name[MAX_ADDR_LEN], *names;
+	size_t len = sizeof name;
+	int i, ret;
+
+	memset(name, 0, sizeof name);
+	ret = fi_getname(&ep->fid, name, &len);
+	if (ret) {
+		printf("fi_getname %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	names = malloc(MAX_ADDR_LEN * nranks);
+	addrs = calloc(nranks, sizeof *addrs);
+	if (!names || !addrs) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	ret = rdv_allgather(name, names, MAX_ADDR_LEN);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < nranks; i++) {
+		ret = fi_av_insert(av, names + i * MAX_ADDR_LEN, 1, &addrs[i], 0, NULL);
+		if (ret < 0) {
+			printf("fi_av_insert %s\n", fi_strerror(-ret));
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	free(names);
+	return ret;
+}
+
+static int init_fabric(void)
+{
+	struct fi_info *fi;
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, NULL, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_domain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err1;
+	}
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err3;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err4;
+
+	ret = exchange_addresses();
+	if (ret)
+		goto err4;
+
+	fi_freeinfo(fi);
+	return 0;
+
+err4:
+	free_ep_res();
+err3:
+	fi_close(&ep->fid);
+err2:
+	fi_close(&dom->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int run(void)
+{
+	int i, ret = 0;
+
+	ret = rdv_init(rdv_addr, port, &rank, &nranks);
+	if (ret)
+		return ret;
+
+	if (nranks < 2) {
+		printf("traffic patterns need at least 2 ranks\n");
+		ret = -FI_EINVAL;
+		goto out;
+	}
+
+	if (pattern == PAT_SHIFT && shift && !(shift % nranks)) {
+		printf("shift %d maps every rank onto itself\n", shift);
+		ret = -FI_EINVAL;
+		goto out;
+	}
+
+	if (pattern == PAT_RANDOM) {
+		ret = init_perm();
+		if (ret)
+			goto out;
+	}
+
+	perf = calloc(num_steps(), sizeof *perf);
+	all_perf = calloc(num_steps() * nranks, sizeof *all_perf);
+	pair_usec = calloc(num_steps(), sizeof *pair_usec);
+	all_phase_usec = calloc(nranks, sizeof *all_phase_usec);
+	if (!perf || !all_perf || !pair_usec || !all_phase_usec) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	ret = init_fabric();
+	if (ret)
+		goto out;
+
+	if (!rank) {
+		printf("pattern %s, %d ranks\n", pattern_str[pattern], nranks);
+		printf("%-8s%-8s%-8s%8s %10s%10s%10s%10s%11s%11s\n",
+		       "bytes", "iters", "total", "time", "MB/sec",
+		       "min MB/s", "avg MB/s", "max MB/s", "avg usec", "max usec");
+	}
+
+	if (!custom) {
+		for (i = 0; i < TEST_CNT; i++) {
+			if (test_size[i].option > size_option)
+				continue;
+			init_test(test_size[i].size);
+			ret = run_test();
+			if (ret)
+				break;
+		}
+	} else {
+		ret = run_test();
+	}
+
+	rdv_barrier();
+	fi_close(&ep->fid);
+	free_ep_res();
+	fi_close(&dom->fid);
+	fi_close(&fab->fid);
+out:
+	free(addrs);
+	free(perf);
+	free(all_perf);
+	free(pair_usec);
+	free(all_phase_usec);
+	free(perm);
+	free(iperm);
+	rdv_close();
+	return ret;
+}
+
+static int str2pattern(char *str)
+{
+	int i;
+
+	for (i = 0; i <= PAT_RANDOM; i++) {
+		if (!strcasecmp(pattern_str[i], str)) {
+			pattern = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:N:P:k:I:S:w:v")) != -1) {
+		switch (op) {
+		case 'd':
+			rdv_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'N':
+			nranks = atoi(optarg);
+			break;
+		case 'P':
+			if (str2pattern(optarg))
+				goto usage;
+			break;
+		case 'k':
+			shift = atoi(optarg);
+			pattern = PAT_SHIFT;
+			break;
+		case 'I':
+			custom_iterations = 1;
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			if (!strncasecmp("all", optarg, 3)) {
+				size_option = SIZE_OPT_ALL;
+			} else if (strpbrk(optarg, ":,")) {
+				if (set_test_sizes(optarg))
+					exit(1);
+			} else {
+				custom = 1;
+				if (parse_transfer_size(optarg, &transfer_size))
+					exit(1);
+			}
+			break;
+		case 'w':
+			max_credits = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_RDM;
+	hints.caps = FI_MSG;
+	hints.mode = FI_LOCAL_MR;
+	hints.addr_format = FI_SOCKADDR;
+
+	ret = run();
+	return ret;
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d rendezvous_address] (all ranks except rank 0)\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p rendezvous_port] (default: 9228)\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-N number_of_ranks] (rank 0 only, default: 2)\n");
+	printf("\t[-P all2all|ring|shift|random] (default: all2all)\n");
+	printf("\t[-k shift_distance] (implies -P shift, default: every distance)\n");
+	printf("\t[-I iterations] (default: dynamic)\n");
+	printf("\t[-S transfer_size or 'all']\n");
+	printf("\t[-S start:end[:xN|:+N][,...]] size sweep, e.g. 64:1m:x2\n");
+	printf("\t[-w window] outstanding sends and receives (default: 64)\n");
+	printf("\t[-v] print per pair results\n");
+	exit(1);
+}
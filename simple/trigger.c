@@ -0,0 +1,908 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ * 
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Times a three step pipeline on the server: a receive completion
+ * starts an RMA write back to the client, and the completed write
+ * starts a send that tells the client its data has landed.  With
+ * -m host the server CPU polls for each step before posting the next
+ * one.  With -m trig the whole chain is posted up front as triggered
+ * operations gated on a receive counter and a write counter, and the
+ * server only replenishes the pipeline as sends complete.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_rma.h>
+#include <rdma/fi_cm.h>
+#include <rdma/fi_trigger.h>
+#include <shared.h>
+
+#define CTRL_SIZE 64
+#define MAX_DEPTH 1024
+
+enum chain_mode {
+	MODE_HOST,
+	MODE_TRIG,
+	MODE_MAX
+};
+
+static const char *mode_str[] = {
+	[MODE_HOST] = "host",
+	[MODE_TRIG] = "trig",
+};
+
+struct pipe_slot {
+	struct fi_triggered_context write_ctx;
+	struct fi_triggered_context send_ctx;
+};
+
+static int custom;
+static int size_option = SIZE_OPT_DEFAULT;
+static int iterations = 1000;
+static int transfer_size = 1000;
+static int depth = 16;
+static int run_mode = MODE_MAX;
+static char test_name[10] = "custom";
+static struct timeval start, end;
+static struct rusage ru_start, ru_end;
+static void *buf;
+static size_t buffer_size;
+static char *ctrl_tx, *ctrl_rx;
+static uint64_t rem_addr, rem_key;
+static struct pipe_slot *pipe_slots;
+
+/* cumulative over the whole run, matched against the counters */
+static uint64_t rx_posted, rx_arrived, wr_posted;
+
+static struct fi_info hints;
+static struct fi_domain_attr domain_hints;
+static struct fi_ep_attr ep_hints;
+static char *dst_addr, *src_addr;
+static char *port = "9228";
+
+static struct fid_fabric *fab;
+static struct fid_pep *pep;
+static struct fid_domain *dom;
+static struct fid_ep *ep;
+static struct fid_eq *cmeq;
+static struct fid_cq *rcq, *scq;
+static struct fid_cntr *rx_cntr, *wr_cntr;
+static struct fid_mr *mr;
+
+
+static float cpu_usec(void)
+{
+	return (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec +
+		ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) * 1000000 +
+	       (ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec +
+		ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec);
+}
+
+static void show_perf(void)
+{
+	char str[32];
+	float usec;
+	long long bytes;
+
+	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+	bytes = (long long) iterations * transfer_size;
+
+	/* name size transfers iterations bytes seconds Gb/sec usec/xfer cpu */
+	printf("%-10s", test_name);
+	size_str(str, sizeof str, transfer_size);
+	printf("%-8s", str);
+	cnt_str(str, sizeof str, 1);
+	printf("%-8s", str);
+	cnt_str(str, sizeof str, iterations);
+	printf("%-8s", str);
+	size_str(str, sizeof str, bytes);
+	printf("%-8s", str);
+	printf("%8.2fs%10.2f%11.2f%7.1f%%\n",
+		usec / 1000000., (bytes * 8) / (1000. * usec),
+		usec / iterations, 100. * cpu_usec() / usec);
+}
+
+static void init_test(int size, int mode)
+{
+	char sstr[5];
+
+	size_str(sstr, sizeof sstr, size);
+	snprintf(test_name, sizeof test_name, "%s_%s", sstr, mode_str[mode]);
+	transfer_size = size;
+	if (!custom)
+		iterations = size_to_count(transfer_size);
+}
+
+static int post_recv(void)
+{
+	int ret;
+
+	ret = fi_recv(ep, ctrl_rx, CTRL_SIZE, fi_mr_desc(mr), NULL);
+	if (ret)
+		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
+	else
+		rx_posted++;
+	return ret;
+}
+
+static int send_ctrl(size_t size)
+{
+	int ret;
+
+	ret = fi_send(ep, ctrl_tx, size, fi_mr_desc(mr), NULL);
+	if (ret) {
+		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+
+	return wait_for_completion(scq, 1);
+}
+
+/* Keep one receive posted beyond the requests consumed so far. */
+static int refill_recv(uint64_t seq)
+{
+	int ret;
+
+	while (rx_posted < seq + 1) {
+		ret = post_recv();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* Errors are only looked for while the count is not moving. */
+static int wait_cntr(struct fid_cntr *cntr, uint64_t value)
+{
+	uint64_t cnt, last;
+
+	for (last = 0; (cnt = fi_cntr_read(cntr)) < value; last = cnt) {
+		if (cnt == last && fi_cntr_readerr(cntr)) {
+			printf("fi_cntr_read %lu errors\n",
+				(unsigned long) fi_cntr_readerr(cntr));
+			return -FI_EOTHER;
+		}
+	}
+	return 0;
+}
+
+static int client_test(void)
+{
+	int ret, i;
+
+	for (i = 0; i < iterations; i++) {
+		ret = send_ctrl(16);
+		if (ret)
+			return ret;
+
+		ret = wait_for_completion(rcq, 1);
+		if (ret)
+			return ret;
+
+		ret = post_recv();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int host_chain(void)
+{
+	int ret, i;
+
+	for (i = 0; i < iterations; i++) {
+		ret = wait_for_completion(rcq, 1);
+		if (ret)
+			return ret;
+
+		ret = refill_recv(++rx_arrived);
+		if (ret)
+			return ret;
+
+		ret = fi_write(ep, buf, transfer_size, fi_mr_desc(mr),
+			       rem_addr, rem_key, NULL);
+		if (ret) {
+			printf("fi_write %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
+
+		ret = wait_cntr(wr_cntr, ++wr_posted);
+		if (ret)
+			return ret;
+
+		ret = send_ctrl(16);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Request seq (counted over the whole run) gates the write on the
+ * receive counter, and the write gates the reply on the write counter.
+ */
+static int post_trig(struct pipe_slot *slot, uint64_t seq)
+{
+	struct fi_msg_rma rma_msg;
+	struct fi_rma_iov rma_iov;
+	struct fi_msg msg;
+	struct iovec iov;
+	void *desc = fi_mr_desc(mr);
+	int ret;
+
+	ret = refill_recv(seq);
+	if (ret)
+		return ret;
+
+	slot->write_ctx.event_type = FI_TRIGGER_THRESHOLD;
+	slot->write_ctx.trigger.threshold.cntr = rx_cntr;
+	slot->write_ctx.trigger.threshold.threshold = seq;
+
+	iov.iov_base = buf;
+	iov.iov_len = transfer_size;
+	rma_iov.addr = rem_addr;
+	rma_iov.len = transfer_size;
+	rma_iov.key = rem_key;
+	memset(&rma_msg, 0, sizeof rma_msg);
+	rma_msg.msg_iov = &iov;
+	rma_msg.desc = &desc;
+	rma_msg.iov_count = 1;
+	rma_msg.rma_iov = &rma_iov;
+	rma_msg.rma_iov_count = 1;
+	rma_msg.context = &slot->write_ctx;
+
+	ret = fi_writemsg(ep, &rma_msg, FI_TRIGGER);
+	if (ret) {
+		printf("fi_writemsg %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+	wr_posted++;
+
+	slot->send_ctx.event_type = FI_TRIGGER_THRESHOLD;
+	slot->send_ctx.trigger.threshold.cntr = wr_cntr;
+	slot->send_ctx.trigger.threshold.threshold = wr_posted;
+
+	iov.iov_base = ctrl_tx;
+	iov.iov_len = 16;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.desc = &desc;
+	msg.iov_count = 1;
+	msg.context = &slot->send_ctx;
+
+	ret = fi_sendmsg(ep, &msg, FI_TRIGGER);
+	if (ret)
+		printf("fi_sendmsg %d (%s)\n", ret, fi_strerror(-ret));
+	return ret;
+}
+
+static int trig_chain(void)
+{
+	uint64_t base = rx_arrived;
+	int ret, posted, done;
+
+	for (posted = 0; posted < MIN(depth, iterations); posted++) {
+		ret = post_trig(&pipe_slots[posted % depth], base + posted + 1);
+		if (ret)
+			return ret;
+	}
+
+	for (done = 0; done < iterations; done++) {
+		ret = wait_for_completion(scq, 1);
+		if (ret)
+			return ret;
+
+		ret = wait_for_completion(rcq, 1);
+		if (ret)
+			return ret;
+		rx_arrived++;
+
+		if (posted < iterations) {
+			ret = post_trig(&pipe_slots[posted % depth],
+					base + posted + 1);
+			if (ret)
+				return ret;
+			posted++;
+		}
+	}
+	return 0;
+}
+
+static int run_test(int mode)
+{
+	int ret;
+
+	gettimeofday(&start, NULL);
+	getrusage(RUSAGE_SELF, &ru_start);
+	if (dst_addr)
+		ret = client_test();
+	else
+		ret = mode == MODE_HOST ? host_chain() : trig_chain();
+	if (ret)
+		return ret;
+	gettimeofday(&end, NULL);
+	getrusage(RUSAGE_SELF, &ru_end);
+
+	show_perf();
+	return 0;
+}
+
+static void free_lres(void)
+{
+	fi_close(&cmeq->fid);
+}
+
+static int alloc_cm_res(void)
+{
+	struct fi_eq_attr cm_attr;
+	int ret;
+
+	memset(&cm_attr, 0, sizeof cm_attr);
+	cm_attr.wait_obj = FI_WAIT_FD;
+	ret = fi_eq_open(fab, &cm_attr, &cmeq, NULL);
+	if (ret)
+		printf("fi_eq_open cm %s\n", fi_strerror(-ret));
+
+	return ret;
+}
+
+static void free_ep_res(void)
+{
+	if (wr_cntr)
+		fi_close(&wr_cntr->fid);
+	if (rx_cntr)
+		fi_close(&rx_cntr->fid);
+	fi_close(&mr->fid);
+	fi_close(&rcq->fid);
+	fi_close(&scq->fid);
+	free(pipe_slots);
+	free(buf);
+}
+
+static int alloc_ep_res(struct fi_info *fi)
+{
+	struct fi_cq_attr cq_attr;
+	struct fi_cntr_attr cntr_attr;
+	int ret;
+
+	buffer_size = !custom ? max_test_size(size_option) : transfer_size;
+	buf = malloc(buffer_size + 2 * CTRL_SIZE);
+	pipe_slots = calloc(depth, sizeof *pipe_slots);
+	if (!buf || !pipe_slots) {
+		perror("malloc");
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+	ctrl_tx = (char *) buf + buffer_size;
+	ctrl_rx = ctrl_tx + CTRL_SIZE;
+
+	memset(&cq_attr, 0, sizeof cq_attr);
+	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
+	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.size = depth * 2 + 2;
+	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	if (ret) {
+		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	if (ret) {
+		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+		goto err2;
+	}
+
+	ret = fi_mr_reg(dom, buf, buffer_size + 2 * CTRL_SIZE,
+			FI_REMOTE_WRITE, 0, 0, 0, &mr, NULL);
+	if (ret) {
+		printf("fi_mr_reg %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	memset(&cntr_attr, 0, sizeof cntr_attr);
+	cntr_attr.events = FI_CNTR_EVENTS_COMP;
+	cntr_attr.wait_obj = FI_WAIT_NONE;
+	ret = fi_cntr_open(dom, &cntr_attr, &rx_cntr, NULL);
+	if (ret) {
+		printf("fi_cntr_open %s\n", fi_strerror(-ret));
+		goto err4;
+	}
+
+	ret = fi_cntr_open(dom, &cntr_attr, &wr_cntr, NULL);
+	if (ret) {
+		printf("fi_cntr_open %s\n", fi_strerror(-ret));
+		goto err5;
+	}
+
+	if (!cmeq) {
+		ret = alloc_cm_res();
+		if (ret)
+			goto err6;
+	}
+
+	return 0;
+
+err6:
+	fi_close(&wr_cntr->fid);
+	wr_cntr = NULL;
+err5:
+	fi_close(&rx_cntr->fid);
+	rx_cntr = NULL;
+err4:
+	fi_close(&mr->fid);
+err3:
+	fi_close(&rcq->fid);
+err2:
+	fi_close(&scq->fid);
+err1:
+	free(pipe_slots);
+	free(buf);
+	return ret;
+}
+
+/*
+ * Writes are only tracked through wr_cntr so both chaining modes pay
+ * for the same completion path.
+ */
+static int bind_ep_res(void)
+{
+	int ret;
+
+	ret = fi_bind(&ep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &rx_cntr->fid, FI_RECV);
+	if (ret) {
+		printf("fi_bind rx cntr %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_bind(&ep->fid, &wr_cntr->fid, FI_WRITE);
+	if (ret) {
+		printf("fi_bind write cntr %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_enable(ep);
+	if (ret)
+		return ret;
+
+	return post_recv();
+}
+
+static int server_listen(void)
+{
+	struct fi_info *fi;
+	int ret;
+
+	ret = fi_getinfo(FI_VERSION(1, 0), src_addr, port, FI_SOURCE, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_pendpoint(fab, fi, &pep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_cm_res();
+	if (ret)
+		goto err2;
+
+	ret = fi_bind(&pep->fid, &cmeq->fid, 0);
+	if (ret) {
+		printf("fi_bind %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = fi_listen(pep);
+	if (ret) {
+		printf("fi_listen %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	fi_freeinfo(fi);
+	return 0;
+err3:
+	free_lres();
+err2:
+	fi_close(&pep->fid);
+err1:
+	fi_close(&fab->fid);
+err0:
+	fi_freeinfo(fi);
+	return ret;
+}
+
+static int server_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *info = NULL;
+	ssize_t rd;
+	int ret;
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		return (int) rd;
+	}
+
+	if (event != FI_CONNREQ) {
+		printf("Unexpected CM event %d\n", event);
+		ret = -FI_EOTHER;
+		goto err1;
+	}
+
+	info = entry.info;
+	ret = fi_domain(fab, info, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_endpoint(dom, info, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint for req %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = alloc_ep_res(info);
+	if (ret)
+		 goto err2;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err3;
+
+	ret = fi_accept(ep, NULL, 0);
+	if (ret) {
+		printf("fi_accept %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_sread %zd %s\n", rd, fi_strerror((int) -rd));
+		goto err3;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err3;
+	}
+
+	fi_freeinfo(info);
+	return 0;
+
+err3:
+	free_ep_res();
+err2:
+	fi_close(&ep->fid);
+err1:
+	fi_reject(pep, info->connreq, NULL, 0);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int client_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	struct fi_info *fi;
+	ssize_t rd;
+	int ret;
+
+	if (src_addr) {
+		ret = getaddr(src_addr, NULL, (struct sockaddr **) &hints.src_addr,
+			      (socklen_t *) &hints.src_addrlen);
+		if (ret)
+			printf("source address error %s\n", gai_strerror(ret));
+	}
+
+	ret = fi_getinfo(FI_VERSION(1, 0), dst_addr, port, 0, &hints, &fi);
+	if (ret) {
+		printf("fi_getinfo %s\n", strerror(-ret));
+		goto err0;
+	}
+
+	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	if (ret) {
+		printf("fi_fabric %s\n", fi_strerror(-ret));
+		goto err1;
+	}
+
+	ret = fi_domain(fab, fi, &dom, NULL);
+	if (ret) {
+		printf("fi_fdomain %s %s\n", fi_strerror(-ret),
+			fi->domain_attr->name);
+		goto err2;
+	}
+
+	ret = fi_endpoint(dom, fi, &ep, NULL);
+	if (ret) {
+		printf("fi_endpoint %s\n", fi_strerror(-ret));
+		goto err3;
+	}
+
+	ret = alloc_ep_res(fi);
+	if (ret)
+		goto err4;
+
+	ret = bind_ep_res();
+	if (ret)
+		goto err5;
+
+	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
+	if (ret) {
+		printf("fi_connect %s\n", fi_strerror(-ret));
+		goto err5;
+	}
+
+	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	if (rd != sizeof entry) {
+		printf("fi_eq_condread %zd %s\n", rd, fi_strerror((int) -rd));
+		ret = (int) rd;
+		goto err5;
+	}
+
+	if (event != FI_COMPLETE || entry.fid != &ep->fid) {
+		printf("Unexpected CM event %d fid %p (ep %p)\n",
+			event, entry.fid, ep);
+		ret = -FI_EOTHER;
+		goto err5;
+	}
+
+	if (hints.src_addr)
+		free(hints.src_addr);
+	fi_freeinfo(fi);
+	return 0;
+
+err5:
+	free_ep_res();
+err4:
+	fi_close(&ep->fid);
+err3:
+	fi_close(&dom->fid);
+err2:
+	fi_close(&fab->fid);
+err1:
+	fi_freeinfo(fi);
+err0:
+	if (hints.src_addr)
+		free(hints.src_addr);
+	return ret;
+}
+
+/* The client hands the server the buffer its writes land in. */
+static int exchange_params(void)
+{
+	int ret;
+
+	if (dst_addr) {
+		((uint64_t *) ctrl_tx)[0] = (uint64_t) buf;
+		((uint64_t *) ctrl_tx)[1] = fi_mr_key(mr);
+		return send_ctrl(sizeof(uint64_t) * 2);
+	}
+
+	ret = wait_for_completion(rcq, 1);
+	if (ret)
+		return ret;
+
+	rem_addr = ((uint64_t *) ctrl_rx)[0];
+	rem_key = ((uint64_t *) ctrl_rx)[1];
+	return refill_recv(++rx_arrived);
+}
+
+static int run_size(int size)
+{
+	int mode, ret;
+
+	for (mode = 0; mode < MODE_MAX; mode++) {
+		if (run_mode != MODE_MAX && run_mode != mode)
+			continue;
+		init_test(size, mode);
+		ret = run_test(mode);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int run(void)
+{
+	int i, ret = 0;
+
+	if (!dst_addr) {
+		ret = server_listen();
+		if (ret)
+			return ret;
+	}
+
+	printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s%8s\n",
+	       "name", "bytes", "xfers", "iters", "total", "time", "Gb/sec",
+	       "usec/xfer", "cpu");
+
+	ret = dst_addr ? client_connect() : server_connect();
+	if (ret)
+		return ret;
+
+	ret = exchange_params();
+	if (ret)
+		goto out;
+
+	if (!custom) {
+		for (i = 0; i < TEST_CNT; i++) {
+			if (test_size[i].option > size_option)
+				continue;
+			ret = run_size(test_size[i].size);
+			if (ret)
+				goto out;
+		}
+	} else {
+		ret = run_size(transfer_size);
+	}
+
+out:
+	fi_shutdown(ep, 0);
+	fi_close(&ep->fid);
+	free_ep_res();
+	if (!dst_addr)
+		free_lres();
+	fi_close(&dom->fid);
+	fi_close(&fab->fid);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int op;
+
+	while ((op = getopt(argc, argv, "d:n:p:s:I:S:m:D:")) != -1) {
+		switch (op) {
+		case 'd':
+			dst_addr = optarg;
+			break;
+		case 'n':
+			domain_hints.name = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'I':
+			custom = 1;
+			iterations = atoi(optarg);
+			break;
+		case 'S':
+			if (!strncasecmp("all", optarg, 3)) {
+				size_option = SIZE_OPT_ALL;
+			} else if (strpbrk(optarg, ":,")) {
+				if (set_test_sizes(optarg))
+					exit(1);
+			} else {
+				custom = 1;
+				if (parse_transfer_size(optarg, &transfer_size))
+					exit(1);
+			}
+			break;
+		case 'm':
+			for (run_mode = 0; run_mode < MODE_MAX; run_mode++) {
+				if (!strcasecmp(mode_str[run_mode], optarg))
+					break;
+			}
+			if (run_mode == MODE_MAX && strcasecmp("all", optarg)) {
+				printf("unknown mode %s\n", optarg);
+				goto usage;
+			}
+			break;
+		case 'D':
+			depth = atoi(optarg);
+			if (depth < 1 || depth > MAX_DEPTH) {
+				printf("depth must be between 1 and %d\n", MAX_DEPTH);
+				goto usage;
+			}
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	hints.domain_attr = &domain_hints;
+	hints.ep_attr = &ep_hints;
+	hints.ep_type = FI_EP_MSG;
+	hints.caps = FI_MSG | FI_RMA;
+	if (run_mode != MODE_HOST)
+		hints.caps |= FI_TRIGGER;
+	hints.mode = FI_LOCAL_MR | FI_PROV_MR_KEY;
+	hints.addr_format = FI_SOCKADDR;
+
+	return run();
+
+usage:
+	printf("usage: %s\n", argv[0]);
+	printf("\t[-d destination_address]\n");
+	printf("\t[-n domain_name]\n");
+	printf("\t[-p port_number]\n");
+	printf("\t[-s source_address]\n");
+	printf("\t[-I iterations]\n");
+	printf("\t[-S transfer_size or 'all']\n");
+	printf("\t[-S start:end[:xN|:+N][,...]] size sweep, e.g. 64:1m:x2\n");
+	printf("\t[-m host|trig|all (chaining mode, default all)]\n");
+	printf("\t[-D triggered pipeline depth (default 16)]\n");
+	exit(1);
+}
@@ -59,7 +59,7 @@
 #include <shared.h>
 
 static int custom;
-static int size_option;
+static int size_option = SIZE_OPT_DEFAULT;
 static int iterations = 1000;
 static int transfer_size = 1000;
 static int max_credits = 128;
@@ -71,6 +71,7 @@ static void *buf_ptr;
 static size_t buffer_size;
 static size_t prefix_len;
 static size_t max_msg_size = 0;
+static int cq_mode;
 
 static struct fi_info hints;
 static struct fi_domain_attr domain_hints;
@@ -106,9 +107,18 @@ static void show_perf(void)
 	printf("%-8s", str);
 	size_str(str, sizeof str, bytes);
 	printf("%-8s", str);
-	printf("%8.2fs%10.2f%11.2f\n",
+	printf("%8.2fs%10.2f%11.2f",
 		usec / 1000000., (bytes * 8) / (1000. * usec),
 		(usec / iterations) / 2);
+	if (cq_mode) {
+		long long polls, empty;
+
+		cq_poll_stats(&polls, &empty);
+		printf("%10.3f%11.2f%8.1f%%", iterations * 2 / usec,
+		       (double) polls / (iterations * 2),
+		       polls ? 100. * empty / polls : 0);
+	}
+	printf("\n");
 }
 
 static void init_test(int size)
@@ -123,42 +133,38 @@ static void init_test(int size)
 
 static int poll_all_sends(void)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
 	do {
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
+		ret = cq_read_tx(scq);
+		if (ret > 0)
 			credits++;
-		} else if (ret < 0) {
-			printf("SCQ read %d (%s)\n", ret, fi_strerror(-ret));
+		else if (ret < 0)
 			return ret;
-		}
 	} while (ret);
 	return 0;
 }
 
 static int send_xfer(int size)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
 	while (!credits) {
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
+		ret = cq_read_tx(scq);
+		if (ret > 0)
 			goto post;
-		} else if (ret < 0) {
-			printf("RCQ read %d (%s)\n", ret, fi_strerror(-ret));
+		else if (ret < 0)
 			return ret;
-		}
 	}
 
 	credits--;
 post:
-	ret = dst_addr ?
-		fi_send(ep, buf_ptr, (size_t) size, fi_mr_desc(mr), NULL) :
-		fi_sendto(ep, buf_ptr, (size_t) size, fi_mr_desc(mr),
-				client_addr, NULL);
+	do {
+		ret = dst_addr ?
+			fi_send(ep, buf_ptr, (size_t) size, fi_mr_desc(mr), NULL) :
+			fi_sendto(ep, buf_ptr, (size_t) size, fi_mr_desc(mr),
+					client_addr, NULL);
+	} while (post_again(&ret, scq));
 	if (ret)
 		printf("fi_send %d (%s)\n", ret, fi_strerror(-ret));
 
@@ -167,18 +173,15 @@ post:
 
 static int recv_xfer(int size)
 {
-	struct fi_cq_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, sizeof comp);
-		if (ret < 0) {
-			printf("recv RCQ read %d (%s)\n", ret, fi_strerror(-ret));
-			return ret;
-		}
-	} while (!ret);
+	ret = cq_wait_rx(rcq, 1);
+	if (ret)
+		return ret;
 
-	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	do {
+		ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	} while (post_again(&ret, rcq));
 	if (ret)
 		printf("fi_recv %d (%s)\n", ret, fi_strerror(-ret));
 
@@ -207,6 +210,7 @@ static int run_test(void)
 	if (ret)
 		goto out;
 
+	cq_poll_reset();
 	gettimeofday(&start, NULL);
 	for (i = 0; i < iterations; i++) {
 		ret = dst_addr ? send_xfer(transfer_size) :
@@ -230,7 +234,8 @@ out:
 static void free_ep_res(void)
 {
 	fi_close(&mr->fid);
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 	fi_close(&scq->fid);
 	free(buf);
 }
@@ -241,7 +246,7 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_av_attr av_attr;
 	int ret;
 
-	buffer_size = !custom ? test_size[TEST_CNT - 1].size : transfer_size;
+	buffer_size = !custom ? max_test_size(size_option) : transfer_size;
 	buffer_size += prefix_len;
 	buf = malloc(buffer_size);
 	if (!buf) {
@@ -254,16 +259,22 @@ static int alloc_ep_res(struct fi_info *fi)
 	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
 	cq_attr.wait_obj = FI_WAIT_NONE;
 	cq_attr.size = max_credits << 1;
+	if (cq_mode == CQ_SHARED)
+		cq_attr.size += max_credits;
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
 	if (ret) {
 		printf("fi_cq_open send comp %s\n", fi_strerror(-ret));
 		goto err1;
 	}
 
-	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
-	if (ret) {
-		printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
-		goto err2;
+	if (cq_mode == CQ_SHARED) {
+		rcq = scq;
+	} else {
+		ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+		if (ret) {
+			printf("fi_cq_open recv comp %s\n", fi_strerror(-ret));
+			goto err2;
+		}
 	}
 
 	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
@@ -286,7 +297,8 @@ static int alloc_ep_res(struct fi_info *fi)
 err4:
 	fi_close(&mr->fid);
 err3:
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 err2:
 	fi_close(&scq->fid);
 err1:
@@ -298,16 +310,19 @@ static int bind_ep_res(void)
 {
 	int ret;
 
-	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND);
+	ret = fi_bind(&ep->fid, &scq->fid,
+		      rcq == scq ? FI_SEND | FI_RECV : FI_SEND);
 	if (ret) {
 		printf("fi_bind scq %d (%s)\n", ret, fi_strerror(-ret));
 		return ret;
 	}
 
-	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
-	if (ret) {
-		printf("fi_bind rcq %d (%s)\n", ret, fi_strerror(-ret));
-		return ret;
+	if (rcq != scq) {
+		ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+		if (ret) {
+			printf("fi_bind rcq %d (%s)\n", ret, fi_strerror(-ret));
+			return ret;
+		}
 	}
 
 	ret = fi_bind(&ep->fid, &av->fid, 0);
@@ -515,9 +530,12 @@ static int run(void)
 	if (ret)
 		return ret;
 
-	printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s\n",
+	printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s",
 	       "name", "bytes", "xfers", "iters", "total", "time",
 		   "Gb/sec", "usec/xfer");
+	if (cq_mode)
+		printf("%10s%11s%9s", "Mmsg/s", "polls/msg", "empty");
+	printf("\n");
 
 	if (!custom) {
 		for (i = 0; i < TEST_CNT; i++) {
@@ -533,6 +551,9 @@ static int run(void)
 		ret = run_test();
 	}
 
+	if (post_eagain())
+		printf("%ld posts retried after -FI_EAGAIN\n", post_eagain());
+
 	while (credits < max_credits)
 		poll_all_sends();
 
@@ -548,7 +569,7 @@ int main(int argc, char **argv)
 {
 	int op, ret;
 
-	while ((op = getopt(argc, argv, "d:n:p:s:C:I:S:")) != -1) {
+	while ((op = getopt(argc, argv, "d:n:p:s:C:I:S:q:")) != -1) {
 		switch (op) {
 		case 'd':
 			dst_addr = optarg;
@@ -568,12 +589,21 @@ int main(int argc, char **argv)
 			break;
 		case 'S':
 			if (!strncasecmp("all", optarg, 3)) {
-				size_option = 1;
+				size_option = SIZE_OPT_ALL;
+			} else if (strpbrk(optarg, ":,")) {
+				if (set_test_sizes(optarg))
+					exit(1);
 			} else {
 				custom = 1;
-				transfer_size = atoi(optarg);
+				if (parse_transfer_size(optarg, &transfer_size))
+					exit(1);
 			}
 			break;
+		case 'q':
+			cq_mode = str_to_cq_mode(optarg);
+			if (cq_mode < 0)
+				exit(1);
+			break;
 		default:
 			printf("usage: %s\n", argv[0]);
 			printf("\t[-d destination_address]\n");
@@ -582,6 +612,8 @@ int main(int argc, char **argv)
 			printf("\t[-s source_address]\n");
 			printf("\t[-I iterations]\n");
 			printf("\t[-S transfer_size or 'all']\n");
+			printf("\t[-S start:end[:xN|:+N][,...]] size sweep, e.g. 64:1m:x2\n");
+			printf("\t[-q split|shared] separate send and receive cqs or one for both\n");
 			exit(1);
 		}
 	}
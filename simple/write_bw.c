@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <netdb.h>
 #include <fcntl.h>
@@ -61,18 +62,38 @@
 #include <rdma/fi_atomic.h>
 #include <shared.h>
 
+enum comp_type {
+	COMP_QUEUE,
+	COMP_CNTR,
+	COMP_CNTR_WAIT,
+	COMP_MAX
+};
+
+static const char *comp_str[] = {
+	[COMP_QUEUE] = "queue",
+	[COMP_CNTR] = "counter",
+	[COMP_CNTR_WAIT] = "counter_wait",
+};
+
 static int custom;
-static int size_option;
+static int size_option = SIZE_OPT_DEFAULT;
 static int iterations = 1000;
 static int transfer_size = 1000;
 static int max_credits = 128;
 static int warmup_iters = 128;
+static enum comp_type comp_type;
+static int overlap;
+static double loops_per_usec;
+static uint64_t cntr_target;
 static char test_name[10] = "custom";
 static struct timeval start, end;
+static struct rusage ru_start, ru_end;
 static void *buf;
 static void *rem_buf;
 static uint64_t rem_key;
 static size_t buffer_size;
+static int cq_mode;
+static long eagain_start;
 
 static struct fi_info hints;
 static struct fi_domain_attr domain_hints;
@@ -87,6 +108,15 @@ static struct fid_ep *ep;
 static struct fid_eq *cmeq;
 static struct fid_cq *rcq, *scq;
 static struct fid_mr *mr;
+static struct fid_cntr *cntr;
+
+static float cpu_usec(void)
+{
+	return (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec +
+		ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) * 1000000 +
+	       (ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec +
+		ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec);
+}
 
 static void show_perf(void)
 {
@@ -97,7 +127,7 @@ static void show_perf(void)
 	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
 	bytes = (long long) iterations * transfer_size * 2;
 
-	/* name size transfers iterations bytes seconds Gb/sec usec/xfer */
+	/* name size transfers iterations bytes seconds Gb/sec usec/xfer Mmsg/s cpu eagain */
 	fprintf(stderr, "%-10s", test_name);
 	size_str(str, sizeof str, transfer_size);
 	fprintf(stderr, "%-8s", str);
@@ -107,9 +137,18 @@ static void show_perf(void)
 	fprintf(stderr, "%-8s", str);
 	size_str(str, sizeof str, bytes);
 	fprintf(stderr, "%-8s", str);
-	fprintf(stderr, "%8.2fs%10.2f%11.2f\n",
+	fprintf(stderr, "%8.2fs%10.2f%11.2f%10.3f%7.1f%%",
 		usec / 1000000., (bytes * 8) / (1000. * usec),
-		(usec / iterations) );
+		(usec / iterations), iterations / usec,
+		100. * cpu_usec() / usec);
+	if (cq_mode) {
+		long long polls, empty;
+
+		cq_poll_stats(&polls, &empty);
+		fprintf(stderr, "%11.2f%8.1f%%", (double) polls / iterations,
+			polls ? 100. * empty / polls : 0);
+	}
+	fprintf(stderr, "%8ld\n", post_eagain() - eagain_start);
 }
 
 static void init_test(int size)
@@ -126,20 +165,24 @@ static int send_msg(int size)
 {
 	int ret;
 
-	ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), NULL);
+	do {
+		ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), NULL);
+	} while (post_again(&ret, scq));
 	if (ret) {
 		fprintf(stderr, "fi_send %d (%s)\n", ret, fi_strerror(-ret));
 		return ret;
 	}
 
-	return wait_for_completion(scq, 1);
+	return cq_wait_tx(scq, 1);
 }
 
 static int post_recv()
 {
 	int ret;
 
-	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), NULL);
+	do {
+		ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	} while (post_again(&ret, rcq));
 	if (ret) {
 		fprintf(stderr, "fi_recv %d (%s)\n", ret, fi_strerror(-ret));
 		return ret;
@@ -152,8 +195,10 @@ static int write_data(size_t size)
 {
 	int ret;
 
-	ret = fi_write(ep, buf, size, fi_mr_desc(mr),  
-		       (uint64_t)rem_buf, rem_key, NULL);
+	do {
+		ret = fi_write(ep, buf, size, fi_mr_desc(mr),
+			       (uint64_t)rem_buf, rem_key, NULL);
+	} while (post_again(&ret, scq));
 	if (ret) {
 		fprintf(stderr, "fi_write %d (%s)\n", ret, fi_strerror(-ret));
 		return ret;
@@ -161,6 +206,38 @@ static int write_data(size_t size)
 	return 0;
 }
 
+/*
+ * RMA completions are reported either through the send CQ or, with
+ * -t counter, by a counter bound to the endpoint for FI_WRITE, in which
+ * case no CQ entries are generated for the transfers themselves.
+ */
+static int wait_for_rma(int num_completions)
+{
+	uint64_t cnt, last;
+	int ret;
+
+	if (comp_type == COMP_QUEUE)
+		return cq_wait_tx(scq, num_completions);
+
+	cntr_target += num_completions;
+	if (comp_type == COMP_CNTR_WAIT) {
+		ret = fi_cntr_wait(cntr, cntr_target, -1);
+		if (ret)
+			fprintf(stderr, "fi_cntr_wait %d (%s)\n", ret, fi_strerror(-ret));
+		return ret;
+	}
+
+	/* errors are only looked for while the count is not moving */
+	for (last = 0; (cnt = fi_cntr_read(cntr)) < cntr_target; last = cnt) {
+		if (cnt == last && fi_cntr_readerr(cntr)) {
+			fprintf(stderr, "fi_cntr_read %lu errors\n",
+				(unsigned long) fi_cntr_readerr(cntr));
+			return -FI_EOTHER;
+		}
+	}
+	return 0;
+}
+
 static int warmup(int iters)
 {
 	int ret, i;
@@ -169,39 +246,115 @@ static int warmup(int iters)
 			return ret;
 	}
 
-	if ((ret = wait_for_completion(scq, iters)) < 0)
+	if ((ret = wait_for_rma(iters)) < 0)
 		return ret;
 
 	return 0;
 }
 
+/*
+ * Overlap mode times one transfer at a time: its post, a compute loop
+ * of work usec, and the wait for its completion.  The work is swept from
+ * none up to four times the plain transfer time.  Overlap is the share
+ * of the plain transfer time the compute hid; once the transfer is
+ * fully hidden, the wait is the bare completion overhead.
+ */
+static int overlap_xfer(double work, int cnt, double *post, double *wait)
+{
+	double t0, t1, t2;
+	int ret, i;
+
+	*post = *wait = 0;
+	for (i = 0; i < cnt; i++) {
+		t0 = get_usec();
+		ret = write_data(transfer_size);
+		if (ret)
+			return ret;
+		t1 = get_usec();
+		work_run(work * loops_per_usec);
+		t2 = get_usec();
+		ret = wait_for_rma(1);
+		if (ret)
+			return ret;
+		*post += t1 - t0;
+		*wait += get_usec() - t2;
+	}
+	*post /= cnt;
+	*wait /= cnt;
+	return 0;
+}
+
+/*
+ * Only the client sweeps.  The server stays passive, so neither the
+ * baseline nor the compute points see traffic in the other direction.
+ */
+static int run_overlap(void)
+{
+	double post, wait, xfer = 0, work, hidden;
+	char str[32];
+	int ret, k, cnt = MIN(iterations, 1000);
+
+	if (!dst_addr)
+		return 0;
+
+	ret = warmup(MIN(warmup_iters, max_credits));
+	if (ret)
+		return ret;
+
+	size_str(str, sizeof str, transfer_size);
+	for (k = -1; k <= 5; k++) {
+		work = k < 0 ? 0 : xfer * (1 << k) / 8;
+		ret = overlap_xfer(work, cnt, &post, &wait);
+		if (ret)
+			return ret;
+
+		fprintf(stderr, "%-10s%-8s%10.2f%10.2f%10.2f%10.2f", test_name, str,
+			work, post, wait, post + work + wait);
+		if (k < 0) {
+			xfer = post + wait;
+			fprintf(stderr, "%9s\n", "-");
+		} else {
+			hidden = xfer - (post + wait);
+			fprintf(stderr, "%8.0f%%\n", 100. * MAX(0, hidden) / xfer);
+		}
+	}
+	return 0;
+}
+
 static int run_test(void)
 {
 	int ret, i, oust;
 
+	if (overlap)
+		return run_overlap();
+
 	ret = warmup(MIN(warmup_iters, max_credits));
 	if (ret)
 		goto out;
 
+	cq_poll_reset();
+	eagain_start = post_eagain();
 	gettimeofday(&start, NULL);
-	for (i = 0, oust =0; i < iterations; i++, oust++) {
+	getrusage(RUSAGE_SELF, &ru_start);
+	for (i = 0, oust = 0; i < iterations; i++) {
 		ret = write_data(transfer_size);
 		if (ret)
 			goto out;
 
-		if (oust == max_credits) {
-			ret = wait_for_completion(scq, oust);
+		if (++oust == max_credits) {
+			ret = wait_for_rma(oust);
 			if (ret)
 				goto out;
 			oust = 0;
 		}
 	}
 
-	ret = wait_for_completion(scq, oust);
+	ret = wait_for_rma(oust);
 	if (ret)
 		goto out;
 
 	gettimeofday(&end, NULL);
+	getrusage(RUSAGE_SELF, &ru_end);
 	show_perf();
 	ret = 0;
 
@@ -230,8 +383,11 @@ static int alloc_cm_res(void)
 
 static void free_ep_res(void)
 {
+	if (cntr)
+		fi_close(&cntr->fid);
 	fi_close(&mr->fid);
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 	fi_close(&scq->fid);
 	free(buf);
 }
@@ -239,9 +395,10 @@ static void free_ep_res(void)
 static int alloc_ep_res(struct fi_info *fi)
 {
 	struct fi_cq_attr cq_attr;
+	struct fi_cntr_attr cntr_attr;
 	int ret;
 
-	buffer_size = !custom ? test_size[TEST_CNT - 1].size : transfer_size;
+	buffer_size = !custom ? max_test_size(size_option) : transfer_size;
 	buf = malloc(MAX(buffer_size, sizeof(uint64_t)));
 	if (!buf) {
 		perror("malloc");
@@ -252,16 +409,22 @@ static int alloc_ep_res(struct fi_info *fi)
 	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
 	cq_attr.wait_obj = FI_WAIT_NONE;
 	cq_attr.size = max_credits << 1;
+	if (cq_mode == CQ_SHARED)
+		cq_attr.size += max_credits;
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
 	if (ret) {
 		fprintf(stderr, "fi_eq_open send comp %s\n", fi_strerror(-ret));
 		goto err1;
 	}
 
-	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
-	if (ret) {
-		fprintf(stderr, "fi_eq_open recv comp %s\n", fi_strerror(-ret));
-		goto err2;
+	if (cq_mode == CQ_SHARED) {
+		rcq = scq;
+	} else {
+		ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+		if (ret) {
+			fprintf(stderr, "fi_eq_open recv comp %s\n", fi_strerror(-ret));
+			goto err2;
+		}
 	}
 	
 	ret = fi_mr_reg(dom, buf, MAX(buffer_size, sizeof(uint64_t)), 
@@ -271,18 +434,36 @@ static int alloc_ep_res(struct fi_info *fi)
 		goto err3;
 	}
 
+	if (comp_type != COMP_QUEUE) {
+		memset(&cntr_attr, 0, sizeof cntr_attr);
+		cntr_attr.events = FI_CNTR_EVENTS_COMP;
+		cntr_attr.wait_obj = comp_type == COMP_CNTR_WAIT ?
+				     FI_WAIT_UNSPEC : FI_WAIT_NONE;
+		ret = fi_cntr_open(dom, &cntr_attr, &cntr, NULL);
+		if (ret) {
+			fprintf(stderr, "fi_cntr_open %s\n", fi_strerror(-ret));
+			goto err4;
+		}
+	}
+
 	if (!cmeq) {
 		ret = alloc_cm_res();
 		if (ret)
-			goto err4;
+			goto err5;
 	}
 
 	return 0;
 
+err5:
+	if (cntr) {
+		fi_close(&cntr->fid);
+		cntr = NULL;
+	}
 err4:
 	fi_close(&mr->fid);
 err3:
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 err2:
 	fi_close(&scq->fid);
 err1:
@@ -300,16 +481,28 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
-	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND|FI_WRITE);
+	ret = fi_bind(&ep->fid, &scq->fid,
+		      (comp_type == COMP_QUEUE ? FI_SEND|FI_WRITE : FI_SEND) |
+		      (rcq == scq ? FI_RECV : 0));
 	if (ret) {
 		printf("fi_bind %s\n", fi_strerror(-ret));
 		return ret;
 	}
 
-	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
-	if (ret) {
-		printf("fi_bind %s\n", fi_strerror(-ret));
-		return ret;
+	if (cntr) {
+		ret = fi_bind(&ep->fid, &cntr->fid, FI_WRITE);
+		if (ret) {
+			printf("fi_bind cntr %s\n", fi_strerror(-ret));
+			return ret;
+		}
+	}
+
+	if (rcq != scq) {
+		ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+		if (ret) {
+			printf("fi_bind %s\n", fi_strerror(-ret));
+			return ret;
+		}
 	}
 
 	ret = fi_enable(ep);
@@ -540,17 +733,18 @@ static void exchange_params(void)
 	*(((uint64_t *) buf + 1)) = fi_mr_key(mr);
 	post_recv();
 	send_msg(sizeof(uint64_t *) * 2);
-	wait_for_completion(rcq, 1);
+	cq_wait_rx(rcq, 1);
 
 	rem_buf = (void *) (*((uint64_t *) buf));
 	rem_key = (uint64_t) (*(((uint64_t *) buf + 1)));
 }
 
+/* One side waits for the other to finish, in overlap mode the passive server. */
 static void synchronize(void)
 {
-	if (dst_addr) {
+	if (overlap ? !dst_addr : dst_addr != NULL) {
 		post_recv();
-		wait_for_completion(rcq, 1);
+		cq_wait_rx(rcq, 1);
 	} else {
 		send_msg(sizeof(uint64_t *));
 	}
@@ -566,8 +760,20 @@ static int run(void)
 			return ret;
 	}
 
-	fprintf(stderr, "%-10s%-8s%-8s%-8s%-8s%8s %10s%13s\n",
-	       "name", "bytes", "xfers", "iters", "total", "time", "Gb/sec", "usec/xfer");
+	if (overlap) {
+		if (dst_addr) {
+			loops_per_usec = work_calibrate();
+			fprintf(stderr, "%-10s%-8s%10s%10s%10s%10s%9s\n", "name",
+				"bytes", "work", "post", "wait", "total", "overlap");
+		}
+	} else {
+		fprintf(stderr, "%-10s%-8s%-8s%-8s%-8s%8s %10s%13s%10s%8s",
+		       "name", "bytes", "xfers", "iters", "total", "time", "Gb/sec",
+		       "usec/xfer", "Mmsg/s", "cpu");
+		if (cq_mode)
+			fprintf(stderr, "%11s%9s", "polls/msg", "empty");
+		fprintf(stderr, "%8s\n", "eagain");
+	}
 
 	ret = dst_addr ? client_connect() : server_connect();
 	if (ret)
@@ -604,7 +810,7 @@ int main(int argc, char **argv)
 {
 	int op, ret;
 
-	while ((op = getopt(argc, argv, "d:n:p:s:C:I:w:S:")) != -1) {
+	while ((op = getopt(argc, argv, "d:n:p:s:C:I:w:S:t:oq:")) != -1) {
 		switch (op) {
 		case 'd':
 			dst_addr = optarg;
@@ -627,12 +833,34 @@ int main(int argc, char **argv)
 			break;
 		case 'S':
 			if (!strncasecmp("all", optarg, 3)) {
-				size_option = 1;
+				size_option = SIZE_OPT_ALL;
+			} else if (strpbrk(optarg, ":,")) {
+				if (set_test_sizes(optarg))
+					exit(1);
 			} else {
 				custom = 1;
-				transfer_size = atoi(optarg);
+				if (parse_transfer_size(optarg, &transfer_size))
+					exit(1);
 			}
 			break;
+		case 't':
+			for (comp_type = 0; comp_type < COMP_MAX; comp_type++) {
+				if (!strcasecmp(comp_str[comp_type], optarg))
+					break;
+			}
+			if (comp_type == COMP_MAX) {
+				fprintf(stderr, "unknown completion type %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'o':
+			overlap = 1;
+			break;
+		case 'q':
+			cq_mode = str_to_cq_mode(optarg);
+			if (cq_mode < 0)
+				exit(1);
+			break;
 		default:
 			fprintf(stderr, "usage: %s\n", argv[0]);
 			fprintf(stderr, "\t[-d destination_address]\n");
@@ -642,6 +870,10 @@ int main(int argc, char **argv)
 			fprintf(stderr, "\t[-I iterations]\n");
 			fprintf(stderr, "\t[-w warmup iterations]\n");
 			fprintf(stderr, "\t[-S transfer_size or 'all']\n");
+			fprintf(stderr, "\t[-S start:end[:xN|:+N][,...]] size sweep, e.g. 64:1m:x2\n");
+			fprintf(stderr, "\t[-q split|shared] separate send and receive cqs or one for both\n");
+			fprintf(stderr, "\t[-t queue|counter|counter_wait (completion type)]\n");
+			fprintf(stderr, "\t[-o] overlap: sweep compute time between post and wait\n");
 			exit(1);
 		}
 	}
@@ -62,7 +62,7 @@
 #include <shared.h>
 
 static int custom;
-static int size_option;
+static int size_option = SIZE_OPT_DEFAULT;
 static int iterations = 1000;
 static int transfer_size = 1000;
 static int max_credits = 128;
@@ -73,6 +73,7 @@ static void *buf;
 static void *rem_buf;
 static uint64_t rem_key;
 static size_t buffer_size;
+static int cq_mode;
 
 static struct fi_info hints;
 static struct fi_domain_attr domain_hints;
@@ -107,9 +108,18 @@ static void show_perf(void)
 	fprintf(stderr, "%-8s", str);
 	size_str(str, sizeof str, bytes);
 	fprintf(stderr, "%-8s", str);
-	fprintf(stderr, "%8.2fs%10.2f%11.2f\n",
+	fprintf(stderr, "%8.2fs%10.2f%11.2f",
 		usec / 1000000., (bytes * 8) / (1000. * usec),
 		(usec / iterations) );
+	if (cq_mode) {
+		long long polls, empty;
+
+		cq_poll_stats(&polls, &empty);
+		fprintf(stderr, "%10.3f%11.2f%8.1f%%", iterations / usec,
+			(double) polls / iterations,
+			polls ? 100. * empty / polls : 0);
+	}
+	fprintf(stderr, "\n");
 }
 
 static void init_test(int size)
@@ -126,20 +136,24 @@ static int send_msg(int size)
 {
 	int ret;
 
-	ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), NULL);
+	do {
+		ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), NULL);
+	} while (post_again(&ret, scq));
 	if (ret) {
 		fprintf(stderr, "fi_send %d (%s)\n", ret, fi_strerror(-ret));
 		return ret;
 	}
 
-	return wait_for_completion(scq, 1);
+	return cq_wait_tx(scq, 1);
 }
 
 static int post_recv()
 {
 	int ret;
 
-	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), NULL);
+	do {
+		ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), buf);
+	} while (post_again(&ret, rcq));
 	if (ret) {
 		fprintf(stderr, "fi_recv %d (%s)\n", ret, fi_strerror(-ret));
 		return ret;
@@ -152,8 +166,10 @@ static int write_data(size_t size)
 {
 	int ret;
 
-	ret = fi_write(ep, buf, size, fi_mr_desc(mr),  
-		       (uint64_t)rem_buf, rem_key, NULL);
+	do {
+		ret = fi_write(ep, buf, size, fi_mr_desc(mr),
+			       (uint64_t)rem_buf, rem_key, NULL);
+	} while (post_again(&ret, scq));
 	if (ret) {
 		fprintf(stderr, "fi_write %d (%s)\n", ret, fi_strerror(-ret));
 		return ret;
@@ -167,7 +183,7 @@ static int warmup(int iters)
 	for (i = 0; i < iters; i++) {
 		if ((ret = write_data(16)) < 0)
 			return ret;
-		if ((ret = wait_for_completion(scq, 1)) < 0)
+		if ((ret = cq_wait_tx(scq, 1)) < 0)
 			return ret;
 	}
 	return 0;
@@ -181,12 +197,13 @@ static int run_test(void)
 	if (ret)
 		goto out;
 
+	cq_poll_reset();
 	gettimeofday(&start, NULL);
 	for (i = 0; i < iterations; i++) {
 		ret = write_data(transfer_size);
 		if (ret)
 			goto out;
-		ret = wait_for_completion(scq, 1);
+		ret = cq_wait_tx(scq, 1);
 		if (ret)
 			goto out;
 	}
@@ -220,7 +237,8 @@ static int alloc_cm_res(void)
 static void free_ep_res(void)
 {
 	fi_close(&mr->fid);
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 	fi_close(&scq->fid);
 	free(buf);
 }
@@ -230,7 +248,7 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_cq_attr cq_attr;
 	int ret;
 
-	buffer_size = !custom ? test_size[TEST_CNT - 1].size : transfer_size;
+	buffer_size = !custom ? max_test_size(size_option) : transfer_size;
 	buf = malloc(MAX(buffer_size, sizeof(uint64_t)));
 	if (!buf) {
 		perror("malloc");
@@ -241,16 +259,22 @@ static int alloc_ep_res(struct fi_info *fi)
 	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
 	cq_attr.wait_obj = FI_WAIT_NONE;
 	cq_attr.size = max_credits << 1;
+	if (cq_mode == CQ_SHARED)
+		cq_attr.size += max_credits;
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
 	if (ret) {
 		fprintf(stderr, "fi_eq_open send comp %s\n", fi_strerror(-ret));
 		goto err1;
 	}
 
-	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
-	if (ret) {
-		fprintf(stderr, "fi_eq_open recv comp %s\n", fi_strerror(-ret));
-		goto err2;
+	if (cq_mode == CQ_SHARED) {
+		rcq = scq;
+	} else {
+		ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+		if (ret) {
+			fprintf(stderr, "fi_eq_open recv comp %s\n", fi_strerror(-ret));
+			goto err2;
+		}
 	}
 	
 	ret = fi_mr_reg(dom, buf, MAX(buffer_size, sizeof(uint64_t)), 
@@ -271,7 +295,8 @@ static int alloc_ep_res(struct fi_info *fi)
 err4:
 	fi_close(&mr->fid);
 err3:
-	fi_close(&rcq->fid);
+	if (rcq != scq)
+		fi_close(&rcq->fid);
 err2:
 	fi_close(&scq->fid);
 err1:
@@ -289,16 +314,19 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
-	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND|FI_WRITE);
+	ret = fi_bind(&ep->fid, &scq->fid, FI_SEND|FI_WRITE|
+		      (rcq == scq ? FI_RECV : 0));
 	if (ret) {
 		printf("fi_bind %s\n", fi_strerror(-ret));
 		return ret;
 	}
 
-	ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
-	if (ret) {
-		printf("fi_bind %s\n", fi_strerror(-ret));
-		return ret;
+	if (rcq != scq) {
+		ret = fi_bind(&ep->fid, &rcq->fid, FI_RECV);
+		if (ret) {
+			printf("fi_bind %s\n", fi_strerror(-ret));
+			return ret;
+		}
 	}
 
 	ret = fi_enable(ep);
@@ -529,7 +557,7 @@ static void exchange_params(void)
 	*(((uint64_t *) buf + 1)) = fi_mr_key(mr);
 	post_recv();
 	send_msg(sizeof(uint64_t *) * 2);
-	wait_for_completion(rcq, 1);
+	cq_wait_rx(rcq, 1);
 
 	rem_buf = (void *) (*((uint64_t *) buf));
 	rem_key = (uint64_t) (*(((uint64_t *) buf + 1)));
@@ -539,7 +567,7 @@ static void synchronize(void)
 {
 	if (dst_addr) {
 		post_recv();
-		wait_for_completion(rcq, 1);
+		cq_wait_rx(rcq, 1);
 	} else {
 		send_msg(sizeof(uint64_t *));
 	}
@@ -555,8 +583,11 @@ static int run(void)
 			return ret;
 	}
 
-	fprintf(stderr, "%-10s%-8s%-8s%-8s%-8s%8s %10s%13s\n",
+	fprintf(stderr, "%-10s%-8s%-8s%-8s%-8s%8s %10s%13s",
 	       "name", "bytes", "xfers", "iters", "total", "time", "Gb/sec", "usec/xfer");
+	if (cq_mode)
+		fprintf(stderr, "%10s%11s%9s", "Mmsg/s", "polls/msg", "empty");
+	fprintf(stderr, "\n");
 
 	ret = dst_addr ? client_connect() : server_connect();
 	if (ret)
@@ -578,6 +609,9 @@ static int run(void)
 	}
 	synchronize();
 
+	if (post_eagain())
+		fprintf(stderr, "%ld posts retried after -FI_EAGAIN\n", post_eagain());
+
 out:
 	fi_shutdown(ep, 0);
 	fi_close(&ep->fid);
@@ -593,7 +627,7 @@ int main(int argc, char **argv)
 {
 	int op, ret;
 
-	while ((op = getopt(argc, argv, "d:n:p:s:C:I:w:S:")) != -1) {
+	while ((op = getopt(argc, argv, "d:n:p:s:C:I:w:S:q:")) != -1) {
 		switch (op) {
 		case 'd':
 			dst_addr = optarg;
@@ -616,12 +650,21 @@ int main(int argc, char **argv)
 			break;
 		case 'S':
 			if (!strncasecmp("all", optarg, 3)) {
-				size_option = 1;
+				size_option = SIZE_OPT_ALL;
+			} else if (strpbrk(optarg, ":,")) {
+				if (set_test_sizes(optarg))
+					exit(1);
 			} else {
 				custom = 1;
-				transfer_size = atoi(optarg);
+				if (parse_transfer_size(optarg, &transfer_size))
+					exit(1);
 			}
 			break;
+		case 'q':
+			cq_mode = str_to_cq_mode(optarg);
+			if (cq_mode < 0)
+				exit(1);
+			break;
 		default:
 			fprintf(stderr, "usage: %s\n", argv[0]);
 			fprintf(stderr, "\t[-d destination_address]\n");
@@ -631,6 +674,8 @@ int main(int argc, char **argv)
 			fprintf(stderr, "\t[-I iterations]\n");
 			fprintf(stderr, "\t[-w warmup iterations]\n");
 			fprintf(stderr, "\t[-S transfer_size or 'all']\n");
+			fprintf(stderr, "\t[-S start:end[:xN|:+N][,...]] size sweep, e.g. 64:1m:x2\n");
+			fprintf(stderr, "\t[-q split|shared] separate send and receive cqs or one for both\n");
 			exit(1);
 		}
 	}